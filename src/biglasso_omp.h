@@ -3,6 +3,12 @@
 #define BIGLASSO_OMP_H_
 #if defined(_OPENMP)
 #include <omp.h>
+#if _OPENMP >= 201307
+// threads of the scans spread evenly over the places: with OMP_PLACES set
+// (e.g. OMP_PLACES=cores) they cover all sockets and each stays on its place,
+// reading the same columns from one scan to the next
+#define OMP_SPREAD proc_bind(spread)
+#endif
 #else
 #ifndef DISABLE_OPENMP
 // use pragma message instead of warning
@@ -12,8 +18,13 @@
 #endif
 inline int omp_get_thread_num() { return 0; }
 inline int omp_get_num_threads() { return 1; }
+inline int omp_get_max_threads() { return 1; }
 inline int omp_get_num_procs() { return 1; }
+inline int omp_in_parallel() { return 0; }
 inline void omp_set_num_threads(int nthread) {}
 inline void omp_set_dynamic(int flag) {}
 #endif
+#ifndef OMP_SPREAD
+#define OMP_SPREAD
+#endif
 #endif //BIGLASSO_OMP_H_
@@ -22,7 +22,7 @@ void slores_init(vector<double>& theta_lam,
                  int *row_idx, vector<int> &col_idx,
                  NumericVector &center, NumericVector &scale,
                  IntegerVector& ylab, int n_pos, int n, int p) {
-  
+  ProfilePhase ph(PH_SAFE);
   double n_pos_ratio = (double)n_pos / n;
   vector<double> deriv_theta_lam(n);
   double prod_deriv_theta_lam = 0.0;
@@ -43,16 +43,16 @@ void slores_init(vector<double>& theta_lam,
   double sum_xmaxTy = crossprod_bm(xMat, y, row_idx, center[xmax_idx], scale[xmax_idx], n, xmax_idx);
   double sign_xmaxTy = sign(sum_xmaxTy);
   int j;
-#pragma omp parallel for private(j) schedule(static) 
+  crossprod_xmax(&prod_PX_Pxmax_xi_pos[0], xMat, xmax_idx, row_idx, col_idx, center, scale, n, p);
   for (j = 0; j < p; j++) {
     X_theta_lam_xi_pos[j] = -z[j] * n; // = -xTy
-    prod_PX_Pxmax_xi_pos[j] = -sign_xmaxTy * crossprod_bm_Xj_Xk(xMat, row_idx, center, scale, n, col_idx[j], xmax_idx); 
+    prod_PX_Pxmax_xi_pos[j] = -sign_xmaxTy * prod_PX_Pxmax_xi_pos[j]; 
     cutoff_xi_pos[j] = prod_PX_Pxmax_xi_pos[j] / n;
   }
 }
 
 // Slores screening
-void slores_screen(int *slores_reject, vector<double>& theta_lam, 
+void slores_screen(BitSet &slores_reject, vector<double>& theta_lam, 
                    double g_theta_lam, double prod_deriv_theta_lam,
                    vector<double>& X_theta_lam_xi_pos,
                    vector<double>& prod_PX_Pxmax_xi_pos,
@@ -83,48 +83,51 @@ void slores_screen(int *slores_reject, vector<double>& theta_lam,
   d_sq_times_n_sq = pow(d * n, 2);
   a2 = n_sq * one_minus_d_sq;
   
-  int j;
-#pragma omp parallel for private(j, a1_xi_pos, a0, Delta, u2star_xi_pos, u2star_xi_neg, T_temp_pos, T_temp_neg, tmp_pos, tmp_neg) schedule(static)
-  for (j = 0; j < p; j++) {
-    // a1_xi_pos = 0.0;
-    // a0 = 0.0; Delta = 0.0;
-    // u2star_xi_pos = 0.0; u2star_xi_neg = 0.0;
-    // T_temp_pos = 0.0; T_temp_neg = 0.0;
+  int b, j, nw = slores_reject.nwords();
+  // each thread owns whole 64-bit words of the mask
+#pragma omp parallel for private(b, j, a1_xi_pos, a0, Delta, u2star_xi_pos, u2star_xi_neg, T_temp_pos, T_temp_neg, tmp_pos, tmp_neg) schedule(static)
+  for (b = 0; b < nw; b++) {
+    for (j = b * 64; j < p && j < (b + 1) * 64; j++) {
+      // a1_xi_pos = 0.0;
+      // a0 = 0.0; Delta = 0.0;
+      // u2star_xi_pos = 0.0; u2star_xi_neg = 0.0;
+      // T_temp_pos = 0.0; T_temp_neg = 0.0;
     
-    a1_xi_pos = 2 * prod_PX_Pxmax_xi_pos[j] * n * one_minus_d_sq;
-    a0 = pow(prod_PX_Pxmax_xi_pos[j], 2) - d_sq_times_n_sq;
-    Delta = pow(a1_xi_pos, 2) - 4 * a2 * a0;
-    if (Delta < 0.0) Delta = 0.0; // in case of -0.0 (at xmax)
+      a1_xi_pos = 2 * prod_PX_Pxmax_xi_pos[j] * n * one_minus_d_sq;
+      a0 = pow(prod_PX_Pxmax_xi_pos[j], 2) - d_sq_times_n_sq;
+      Delta = pow(a1_xi_pos, 2) - 4 * a2 * a0;
+      if (Delta < 0.0) Delta = 0.0; // in case of -0.0 (at xmax)
     
-    if (cutoff_xi_pos[j] >= d) {
-      T_xi_pos[j] = r * sqrt(n) - X_theta_lam_xi_pos[j];
-    } else {
-      u2star_xi_pos = 0.5 * (-a1_xi_pos + sqrt(Delta)) / a2;
-      tmp_pos = n + n * pow(u2star_xi_pos, 2) + 2 * u2star_xi_pos * prod_PX_Pxmax_xi_pos[j];
-      if (tmp_pos < 0.0) tmp_pos = 0.0; // in case of -0.0 (at xmax)
-      T_temp_pos = sqrt(tmp_pos);
-      T_xi_pos[j] = r * T_temp_pos - u2star_xi_pos * n * (lambda_max - lambda) - X_theta_lam_xi_pos[j];
-    }
-    
-    if (T_xi_pos[j] + TOLERANCE > n * lambda) { // cannot reject since T_xi_pos >= n * lambda, no need to compute T_xi_neg
-      slores_reject[j] = 0;
-    } else {
-      // compute T_xi_neg: two cases
-      // cutoff_xi_neg = -cutoff_xi_pos;
-      if (-cutoff_xi_pos[j] >= d) {
-        T_xi_neg[j] = r * sqrt(n) + X_theta_lam_xi_pos[j];
+      if (cutoff_xi_pos[j] >= d) {
+        T_xi_pos[j] = r * sqrt(n) - X_theta_lam_xi_pos[j];
       } else {
-        // a1_xi_neg = -a1_xi_pos;
-        u2star_xi_neg = 0.5 * (a1_xi_pos + sqrt(Delta)) / a2;
-        tmp_neg = n + n * pow(u2star_xi_neg, 2) + 2 * u2star_xi_neg * prod_PX_Pxmax_xi_pos[j];
-        if (tmp_neg < 0.0) tmp_neg = 0.0; // in case of -0.0 (at xmax)
-        T_temp_neg = sqrt(tmp_neg);
-        T_xi_neg[j] = r * T_temp_neg - u2star_xi_neg * n * (lambda_max - lambda) + X_theta_lam_xi_pos[j];
+        u2star_xi_pos = 0.5 * (-a1_xi_pos + sqrt(Delta)) / a2;
+        tmp_pos = n + n * pow(u2star_xi_pos, 2) + 2 * u2star_xi_pos * prod_PX_Pxmax_xi_pos[j];
+        if (tmp_pos < 0.0) tmp_pos = 0.0; // in case of -0.0 (at xmax)
+        T_temp_pos = sqrt(tmp_pos);
+        T_xi_pos[j] = r * T_temp_pos - u2star_xi_pos * n * (lambda_max - lambda) - X_theta_lam_xi_pos[j];
       }
-      if (T_xi_neg[j] + TOLERANCE > n * lambda) { // cannot reject since T_xi_neg > n * lambda
-        slores_reject[j] = 0;
+    
+      if (T_xi_pos[j] + TOLERANCE > n * lambda) { // cannot reject since T_xi_pos >= n * lambda, no need to compute T_xi_neg
+        slores_reject.reset(j);
       } else {
-        slores_reject[j] = 1; // both T_xi_pos and T_xi_pos are less than n * lambda
+        // compute T_xi_neg: two cases
+        // cutoff_xi_neg = -cutoff_xi_pos;
+        if (-cutoff_xi_pos[j] >= d) {
+          T_xi_neg[j] = r * sqrt(n) + X_theta_lam_xi_pos[j];
+        } else {
+          // a1_xi_neg = -a1_xi_pos;
+          u2star_xi_neg = 0.5 * (a1_xi_pos + sqrt(Delta)) / a2;
+          tmp_neg = n + n * pow(u2star_xi_neg, 2) + 2 * u2star_xi_neg * prod_PX_Pxmax_xi_pos[j];
+          if (tmp_neg < 0.0) tmp_neg = 0.0; // in case of -0.0 (at xmax)
+          T_temp_neg = sqrt(tmp_neg);
+          T_xi_neg[j] = r * T_temp_neg - u2star_xi_neg * n * (lambda_max - lambda) + X_theta_lam_xi_pos[j];
+        }
+        if (T_xi_neg[j] + TOLERANCE > n * lambda) { // cannot reject since T_xi_neg > n * lambda
+          slores_reject.reset(j);
+        } else {
+          slores_reject.set(j); // both T_xi_pos and T_xi_pos are less than n * lambda
+        }
       }
     }
   }
@@ -139,7 +142,7 @@ void slores_update(vector<double>& theta_lam, vector<double> &z,
                    int *row_idx, vector<int> &col_idx,
                    NumericVector &center, NumericVector &scale,
                    IntegerVector& ylab, int n, int p) {
-  
+  ProfilePhase ph(PH_SAFE);
   vector<double> deriv_theta_lam(n);
   double prod_deriv_theta_lam = 0.0;
   for (int i = 0; i < n; i++) {
@@ -153,20 +156,25 @@ void slores_update(vector<double>& theta_lam, vector<double> &z,
   *prod_deriv_theta_lam_ptr = prod_deriv_theta_lam;
   *g_theta_lam_ptr = dual_bin(theta_lam, 1.0, 1.0, n);
   
-  MatrixAccessor<double> xAcc(*xMat);
+  ColumnStream cs(xMat, col_idx, NULL, p);
   double *xCol;
-  int j, jj;
+  int j, jj, k, nb;
   double sum_xr;
-#pragma omp parallel for private(j, jj, xCol, sum_xr) schedule(static)
-  for (j = 0; j < p; j++) {
-    jj = col_idx[j];
-    xCol = xAcc[jj];
-    sum_xr = 0.0;
-    for(int i = 0; i < n; i++) {
-      sum_xr = sum_xr + xCol[row_idx[i]] * r[i];
+  prof_reads(p);
+  while (cs.next()) {
+    nb = cs.size();
+#pragma omp parallel for private(j, jj, k, xCol, sum_xr) schedule(static)
+    for (k = 0; k < nb; k++) {
+      j = cs.col(k);
+      jj = col_idx[j];
+      xCol = cs.data(k);
+      sum_xr = 0.0;
+      for(int i = 0; i < n; i++) {
+        sum_xr = sum_xr + xCol[row_idx[i]] * r[i];
+      }
+      z[j] = (sum_xr - center[jj] * sumResid) / scale[jj] / n;
+      X_theta_lam_xi_pos[j] = -z[j] * n; 
     }
-    z[j] = (sum_xr - center[jj] * sumResid) / scale[jj] / n;
-    X_theta_lam_xi_pos[j] = -z[j] * n; 
   }
   
 }
@@ -178,12 +186,13 @@ void slores_update_xmax(vector<double>& prod_PX_Pxmax_xi_pos,
                         int *row_idx,vector<int> &col_idx,
                         NumericVector &center, NumericVector &scale,
                         int n, int p) {
+  ProfilePhase ph(PH_SAFE);
   double sum_xmaxTy = crossprod_bm(xMat, y, row_idx, center[xmax_idx], scale[xmax_idx], n, xmax_idx);
   double sign_xmaxTy = sign(sum_xmaxTy);
   int j;
-#pragma omp parallel for private(j) schedule(static) 
+  crossprod_xmax(&prod_PX_Pxmax_xi_pos[0], xMat, xmax_idx, row_idx, col_idx, center, scale, n, p);
   for (j = 0; j < p; j++) {
-    prod_PX_Pxmax_xi_pos[j] = -sign_xmaxTy * crossprod_bm_Xj_Xk(xMat, row_idx, center, scale, n, col_idx[j], xmax_idx); 
+    prod_PX_Pxmax_xi_pos[j] = -sign_xmaxTy * prod_PX_Pxmax_xi_pos[j]; 
     cutoff_xi_pos[j] = prod_PX_Pxmax_xi_pos[j] / n;
   }
 }
@@ -193,7 +202,8 @@ RcppExport SEXP cdfit_binomial_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
                                    SEXP lambda_, SEXP nlambda_, SEXP lam_scale_,
                                    SEXP lambda_min_, SEXP alpha_, SEXP user_, SEXP eps_, 
                                    SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
-                                   SEXP ncore_, SEXP warn_, SEXP verbose_) {
+                                   SEXP ncore_, SEXP warn_, SEXP accel_, SEXP gap_stop_,
+                                   SEXP order_, SEXP verbose_, SEXP io_) {
   XPtr<BigMatrix> xMat(X_);
   double *y = REAL(y_);
   int *row_idx = INTEGER(row_idx_);
@@ -208,6 +218,9 @@ RcppExport SEXP cdfit_binomial_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
   double *m = REAL(multiplier_);
   int dfmax = INTEGER(dfmax_)[0];
   int warn = INTEGER(warn_)[0];
+  int accel = INTEGER(accel_)[0];
+  int gap_stop = INTEGER(gap_stop_)[0];
+  int order = INTEGER(order_)[0]; // 0: cyclic, 1: random, 2: greedy
   int user = INTEGER(user_)[0];
   int verbose = INTEGER(verbose_)[0];
   
@@ -215,6 +228,8 @@ RcppExport SEXP cdfit_binomial_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
   NumericVector Dev(L);
   IntegerVector iter(L);
   IntegerVector n_reject(L);
+  IntegerVector n_accel(L); // accepted extrapolations
+  NumericVector gap(L); // duality gap at each lambda
   NumericVector beta0(L);
   NumericVector center(p);
   NumericVector scale(p);
@@ -238,6 +253,9 @@ RcppExport SEXP cdfit_binomial_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
   omp_set_num_threads(useCores);
 #endif
   
+  ProfileFit pf(n, L);
+  IoOptions io(io_);
+  
   if (verbose) {
     char buff1[100];
     time_t now1 = time (0);
@@ -259,21 +277,40 @@ RcppExport SEXP cdfit_binomial_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
   }
   
   arma::sp_mat beta = arma::sp_mat(p, L); //beta
-  double *a = Calloc(p, double); //Beta from previous iteration
+  WorkBuf<double> a(p); //Beta from previous iteration
   double a0 = 0.0; //beta0 from previousiteration
-  double *w = Calloc(n, double);
-  double *s = Calloc(n, double); //y_i - pi_i
-  double *eta = Calloc(n, double);
-  int *e1 = Calloc(p, int); //ever-active set
-  int *e2 = Calloc(p, int); //strong set
+  WorkBuf<double> w(n);
+  WorkBuf<double> s(n); //y_i - pi_i
+  WorkBuf<double> eta(n);
+  IndexSet e1(p); // ever-active set
+  IndexSet e2(p); // strong set
   double xwr, xwx, pi, u, v, cutoff, l1, l2, shift, si;
   double max_update, update, thresh; // for convergence check
+  double ws_thresh, ws_gap, ws_prev; // working-set gap, tightened when the full gap fails
   int i, j, jj, l, violations, lstart;
+  // compact list of ever-active features, visited in the order given by ord
+  int n_act = 0, t, k;
+  vector<int> act, ord;
+  vector<double> viol; // KKT residual of each coordinate at its last visit
+  if (order == 1) GetRNGstate();
+  // Anderson extrapolation over the ever-active set and intercept, every K sweeps
+  int K = 5, n_hist = 0;
+  vector<double> hist, extr;
+  WorkBuf<double> eta_extr(accel ? n : 0);
+  // duality gap: gradients over ever-active set and over all features
+  int swept = 0;
+  vector<int> all;
+  vector<double> grad, c_act, c_all;
+  if (gap_stop) {
+    for (j = 0; j < p; j++) all.push_back(j);
+    grad.resize(p);
+    c_all.resize(p);
+  }
   
   double ybar = sum(y, n) / n;
   a0 = beta0[0] = log(ybar / (1-ybar));
   double nullDev = 0;
-  double *r = Calloc(n, double);
+  WorkBuf<double> r(n);
   for (i = 0; i < n; i++) {
     r[i] = y[i];
     nullDev = nullDev - y[i]*log(ybar) - (1-y[i])*log(1-ybar);
@@ -310,6 +347,7 @@ RcppExport SEXP cdfit_binomial_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
   }
   
   for (l = lstart; l < L; l++) {
+    prof_lambda(l);
     if(verbose) {
       // output time
       char buff[100];
@@ -321,45 +359,59 @@ RcppExport SEXP cdfit_binomial_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
     if (l != 0) {
       // Check dfmax
       int nv = 0;
-      for (j = 0; j < p; j++) {
-        if (a[j] != 0) {
-          nv++;
-        }
+      for (int h = 0; h < e1.size(); h++) {
+        if (a[e1.idx[h]] != 0) nv++;
       }
       if (nv > dfmax) {
         for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
-        Free(s); Free(w); Free(a); Free(r); Free(e1); Free(e2); Free(eta);
+        if (order == 1) PutRNGstate();
         return List::create(beta0, beta, center, scale, lambda, Dev, 
-                            iter, n_reject, Rcpp::wrap(col_idx));
+                            iter, n_reject, Rcpp::wrap(col_idx), n_accel, gap);
       }
       
       // strong set
       cutoff = 2*lambda[l] - lambda[l-1];
+      e2.clear();
       for (j = 0; j < p; j++) {
         if (fabs(z[j]) > (cutoff * alpha * m[col_idx[j]])) {
-          e2[j] = 1;
-        } else {
-          e2[j] = 0;
+          e2.add(j);
         }
       }
       
     } else {
       // strong set
       cutoff = 2*lambda[l] - lambda_max;
+      e2.clear();
       for (j = 0; j < p; j++) {
         if (fabs(z[j]) > (cutoff * alpha * m[col_idx[j]])) {
-          e2[j] = 1;
-        } else {
-          e2[j] = 0;
+          e2.add(j);
         }
       }
     }
     
-    n_reject[l] = p - sum(e2, p);
+    n_reject[l] = p - e2.size();
+    ws_thresh = thresh;
+    prof_phase(PH_SWEEP);
     while (iter[l] < max_iter) {
       while (iter[l] < max_iter) {
+        act = e1.idx;
+        n_act = act.size();
+        ord.resize(n_act);
+        for (t = 0; t < n_act; t++) ord[t] = t;
+        viol.assign(n_act, 0.0);
+        if (gap_stop) {
+          c_act.resize(n_act);
+          swept = 0;
+          ws_prev = R_PosInf;
+        }
+        if (accel) {
+          hist.resize((n_act + 1) * (K + 1));
+          extr.resize(n_act + 1);
+          n_hist = 0;
+        }
         while (iter[l] < max_iter) {
           iter[l]++;
+          prof_sweep();
           Dev[l] = 0.0;
           
           for (i = 0; i < n; i++) {
@@ -385,9 +437,18 @@ RcppExport SEXP cdfit_binomial_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
           if (Dev[l] / nullDev < .01) {
             if (warn) warning("Model saturated; exiting...");
             for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
-            Free(s); Free(w); Free(a); Free(r); Free(e1); Free(e2); Free(eta);
+            if (order == 1) PutRNGstate();
             return List::create(beta0, beta, center, scale, lambda, Dev,
-                                iter, n_reject, Rcpp::wrap(col_idx));
+                                iter, n_reject, Rcpp::wrap(col_idx), n_accel, gap);
+          }
+          
+          // duality gap over ever-active set, with gradients from the last sweep
+          if (gap_stop && swept) {
+            for (t = 0; t < n_act; t++) c_act[t] = grad[act[t]];
+            // stop once the gap is small enough or no longer shrinks
+            ws_gap = gap_binomial(s, y, Dev[l], a, c_act, act, col_idx, m, lambda[l], alpha, n);
+            if (ws_gap < ws_thresh || ws_gap >= ws_prev) break;
+            ws_prev = ws_gap;
           }
           
           // Intercept
@@ -405,31 +466,65 @@ RcppExport SEXP cdfit_binomial_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
           sumWResid = wsum(r, w, n); // update temp result: sum of w * r, used for computing xwr;
           
           max_update = 0.0;
-          for (j = 0; j < p; j++) {
-            if (e1[j]) {
-              jj = col_idx[j];
-              xwr = wcrossprod_resid(xMat, r, sumWResid, row_idx, center[jj], scale[jj], w, n, jj);
-              v = wsqsum_bm(xMat, w, row_idx, center[jj], scale[jj], n, jj) / n;
-              u = xwr/n + v * a[j];
-              l1 = lambda[l] * m[jj] * alpha;
-              l2 = lambda[l] * m[jj] * (1-alpha);
-              beta(j, l) = lasso(u, l1, l2, v);
+          sweep_order(ord, viol, order);
+          for (k = 0; k < n_act; k++) {
+            t = ord[k];
+            j = act[t];
+            jj = col_idx[j];
+            xwr = wcrossprod_resid(xMat, r, sumWResid, row_idx, center[jj], scale[jj], w, n, jj);
+            v = wsqsum_bm(xMat, w, row_idx, center[jj], scale[jj], n, jj) / n;
+            u = xwr/n + v * a[j];
+            l1 = lambda[l] * m[jj] * alpha;
+            l2 = lambda[l] * m[jj] * (1-alpha);
+            beta(j, l) = lasso(u, l1, l2, v);
+            if (gap_stop) grad[j] = u - v * beta(j, l);
+            if (order == 2) viol[t] = kkt_resid(xwr / n, a[j], l1, l2 * v); // as lasso() scales l2
+            
+            shift = beta(j, l) - a[j];
+            if (shift !=0) {
+              // update change of objective function
+              // update = - u * shift + (0.5 * v + 0.5 * l2) * (pow(beta(j, l), 2) - pow(a[j], 2)) + l1 * (fabs(beta(j, l)) - fabs(a[j]));
               
-              shift = beta(j, l) - a[j];
-              if (shift !=0) {
-                // update change of objective function
-                // update = - u * shift + (0.5 * v + 0.5 * l2) * (pow(beta(j, l), 2) - pow(a[j], 2)) + l1 * (fabs(beta(j, l)) - fabs(a[j]));
-                
-                update = pow(beta(j, l) - a[j], 2) * v;
-                if (update > max_update) max_update = update;
-                update_resid_eta(r, eta, xMat, shift, row_idx, center[jj], scale[jj], n, jj); // update r
-                sumWResid = wsum(r, w, n); // update temp result w * r, used for computing xwr;
-                a[j] = beta(j, l); // update a
-              }
+              update = pow(beta(j, l) - a[j], 2) * v;
+              if (update > max_update) max_update = update;
+              update_resid_eta(r, eta, xMat, shift, row_idx, center[jj], scale[jj], n, jj); // update r
+              sumWResid = wsum(r, w, n); // update temp result w * r, used for computing xwr;
+              a[j] = beta(j, l); // update a
             }
           }
           // Check for convergence
-          if (max_update < thresh)  break;
+          if (gap_stop) {
+            swept = 1;
+          } else if (max_update < thresh) break;
+          
+          if (accel && n_act > 0) {
+            for (t = 0; t < n_act; t++) hist[n_hist * (n_act + 1) + t] = a[act[t]];
+            hist[n_hist * (n_act + 1) + n_act] = a0;
+            if (++n_hist == K + 1) {
+              n_hist = 0;
+              if (anderson_extrapolate(&extr[0], hist, n_act + 1, K)) {
+                // accept extrapolated point only if it decreases the objective
+                for (i = 0; i < n; i++) eta_extr[i] = eta[i] + extr[n_act] - a0;
+                for (t = 0; t < n_act; t++) {
+                  j = act[t];
+                  jj = col_idx[j];
+                  shift = extr[t] - a[j];
+                  if (shift != 0) update_resid(xMat, eta_extr, -shift, row_idx, center[jj], scale[jj], n, jj);
+                }
+                double obj = binomial_dev(y, eta, n) / n + enet_penalty(a, act, n_act, col_idx, m, lambda[l], alpha);
+                for (t = 0; t < n_act; t++) swap(a[act[t]], extr[t]);
+                double obj_extr = binomial_dev(y, eta_extr, n) / n + enet_penalty(a, act, n_act, col_idx, m, lambda[l], alpha);
+                if (obj_extr < obj) {
+                  swap(eta, eta_extr);
+                  a0 = beta0[l] = extr[n_act];
+                  for (t = 0; t < n_act; t++) beta(act[t], l) = a[act[t]];
+                  n_accel[l]++;
+                } else {
+                  for (t = 0; t < n_act; t++) swap(a[act[t]], extr[t]);
+                }
+              }
+            }
+          }
         }
         // Scan for violations in strong set
         sumS = sum(s, n);
@@ -438,11 +533,25 @@ RcppExport SEXP cdfit_binomial_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
       }
       // Scan for violations in rest
       violations = check_rest_set(e1, e2, z, xMat, row_idx, col_idx, center, scale, a, lambda[l], sumS, alpha, s, m, n, p);
-      if (violations==0) break;
+      if (violations==0) {
+        if (gap_stop) {
+          // z of inactive features is up to date from the KKT scans
+          ws_crossprod(c_act, act, xMat, s, sumS, row_idx, col_idx, center, scale, n);
+          for (j = 0; j < p; j++) c_all[j] = z[j];
+          for (t = 0; t < n_act; t++) c_all[act[t]] = c_act[t];
+          gap[l] = gap_binomial(s, y, Dev[l], a, c_all, all, col_idx, m, lambda[l], alpha, n);
+          if (gap[l] >= thresh) {
+            // sweep the ever-active set to a smaller gap before scanning again
+            ws_thresh /= 2;
+            continue;
+          }
+        }
+        break;
+      }
     }
   }
-  Free(s); Free(w); Free(a); Free(r); Free(e1); Free(e2); Free(eta);
-  return List::create(beta0, beta, center, scale, lambda, Dev, iter, n_reject, Rcpp::wrap(col_idx));
+  if (order == 1) PutRNGstate();
+  return List::create(beta0, beta, center, scale, lambda, Dev, iter, n_reject, Rcpp::wrap(col_idx), n_accel, gap);
   
 }
 
@@ -451,7 +560,7 @@ RcppExport SEXP cdfit_binomial_ssr_approx(SEXP X_, SEXP y_, SEXP row_idx_,
                                           SEXP lambda_, SEXP nlambda_,
                                           SEXP lambda_min_, SEXP alpha_, SEXP user_, SEXP eps_, 
                                           SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
-                                          SEXP ncore_, SEXP warn_, SEXP verbose_) {
+                                          SEXP ncore_, SEXP warn_, SEXP verbose_, SEXP io_) {
   XPtr<BigMatrix> xMat(X_);
   double *y = REAL(y_);
   int *row_idx = INTEGER(row_idx_);
@@ -496,6 +605,9 @@ RcppExport SEXP cdfit_binomial_ssr_approx(SEXP X_, SEXP y_, SEXP row_idx_,
   omp_set_num_threads(useCores);
 #endif
   
+  ProfileFit pf(n, L);
+  IoOptions io(io_);
+  
   if (verbose) {
     char buff1[100];
     time_t now1 = time (0);
@@ -518,13 +630,13 @@ RcppExport SEXP cdfit_binomial_ssr_approx(SEXP X_, SEXP y_, SEXP row_idx_,
   }
   
   arma::sp_mat beta = arma::sp_mat(p, L); //beta
-  double *a = Calloc(p, double); //Beta from previous iteration
+  WorkBuf<double> a(p); //Beta from previous iteration
   double a0 = 0.0; //beta0 from previousiteration
-  double *w = Calloc(n, double);
-  double *s = Calloc(n, double); //y_i - pi_i
-  double *eta = Calloc(n, double);
-  int *e1 = Calloc(p, int); //ever-active set
-  int *e2 = Calloc(p, int); //strong set
+  WorkBuf<double> w(n);
+  WorkBuf<double> s(n); //y_i - pi_i
+  WorkBuf<double> eta(n);
+  IndexSet e1(p); // ever-active set
+  IndexSet e2(p); // strong set
   double xwr, xwx, pi, u, v, cutoff, l1, l2, shift, si;
   double max_update, update, thresh; // for convergence check
   int i, j, jj, l, violations, lstart; // temp index
@@ -532,7 +644,7 @@ RcppExport SEXP cdfit_binomial_ssr_approx(SEXP X_, SEXP y_, SEXP row_idx_,
   double ybar = sum(y, n)/n;
   a0 = beta0[0] = log(ybar/(1-ybar));
   double nullDev = 0;
-  double *r = Calloc(n, double);
+  WorkBuf<double> r(n);
   for (i = 0; i < n; i++) {
     r[i] = y[i];
     nullDev = nullDev - y[i] * log(ybar) - (1 - y[i]) * log(1 - ybar);
@@ -562,6 +674,7 @@ RcppExport SEXP cdfit_binomial_ssr_approx(SEXP X_, SEXP y_, SEXP row_idx_,
   }
   
   for (l = lstart; l < L; l++) {
+    prof_lambda(l);
     if(verbose) {
       // output time
       char buff[100];
@@ -573,24 +686,21 @@ RcppExport SEXP cdfit_binomial_ssr_approx(SEXP X_, SEXP y_, SEXP row_idx_,
     if (l != 0) {
       // Check dfmax
       int nv = 0;
-      for (j = 0; j < p; j++) {
-        if (a[j] != 0) {
-          nv++;
-        }
+      for (int h = 0; h < e1.size(); h++) {
+        if (a[e1.idx[h]] != 0) nv++;
       }
       if (nv > dfmax) {
         for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
-        Free(s); Free(w); Free(a); Free(r); Free(e1); Free(e2); Free(eta);
         return List::create(beta0, beta, center, scale, lambda, Dev, 
                             iter, n_reject, Rcpp::wrap(col_idx));
       }
       // strong set
       cutoff = 2*lambda[l] - lambda[l-1];
+      e2.clear();
+      e2.clear();
       for (j = 0; j < p; j++) {
         if (fabs(z[j]) > (cutoff * alpha * m[col_idx[j]])) {
-          e2[j] = 1;
-        } else {
-          e2[j] = 0;
+          e2.add(j);
         }
       }
     } else {
@@ -598,18 +708,18 @@ RcppExport SEXP cdfit_binomial_ssr_approx(SEXP X_, SEXP y_, SEXP row_idx_,
       cutoff = 2*lambda[l] - lambda_max;
       for (int j=0; j<p; j++) {
         if (fabs(z[j]) > (cutoff * alpha * m[col_idx[j]])) {
-          e2[j] = 1;
-        } else {
-          e2[j] = 0;
+          e2.add(j);
         }
       }
     }
-    n_reject[l] = p - sum(e2, p);
+    n_reject[l] = p - e2.size();
     
+    prof_phase(PH_SWEEP);
     while (iter[l] < max_iter) {
       while (iter[l] < max_iter) {
         while (iter[l] < max_iter) {
           iter[l]++;
+          prof_sweep();
           Dev[l] = 0.0;
           for (i = 0; i < n; i++) {
             if (eta[i] > 10) {
@@ -634,7 +744,6 @@ RcppExport SEXP cdfit_binomial_ssr_approx(SEXP X_, SEXP y_, SEXP row_idx_,
           if (Dev[l] / nullDev < .01) {
             if (warn) warning("Model saturated; exiting...");
             for (int ll = l; ll < L; ll++) iter[ll] = NA_INTEGER;
-            Free(s); Free(w); Free(a); Free(r); Free(e1); Free(e2); Free(eta);
             return List::create(beta0, beta, center, scale, lambda, Dev, 
                                 iter, n_reject, Rcpp::wrap(col_idx));
           }
@@ -656,28 +765,27 @@ RcppExport SEXP cdfit_binomial_ssr_approx(SEXP X_, SEXP y_, SEXP row_idx_,
           // sumWResid = wsum(r, w, n);
           
           max_update = 0.0;
-          for (j = 0; j < p; j++) {
-            if (e1[j]) {
-              jj = col_idx[j];
-              xwr = 0.25 * crossprod_resid(xMat, r, sumResid, row_idx, center[jj], scale[jj], n, jj);
-              v = 0.25; // x^T * W * x / n = w = 0.25
-              // xwr = wcrossprod_resid(xMat, r, sumWResid, row_idx, center[j], scale[j], w, n, j);
-              // v = wsqsum_bm(xMat, w, row_idx, center[j], scale[j], n, j) / n;
-              u = xwr / n + v * a[j];
-              l1 = lambda[l] * m[jj] * alpha;
-              l2 = lambda[l] * m[jj] * (1 - alpha);
-              beta(j, l) = lasso(u, l1, l2, v);
-              
-              shift = beta(j, l) - a[j];
-              if (shift !=0) {
-                // update change of objective function
-                // update = - u * shift + (0.5 * v + 0.5 * l2) * (pow(beta(j, l), 2) - pow(a[j], 2)) + l1 * (fabs(beta(j, l)) - fabs(a[j]));
-                update = pow(beta(j, l) - a[j], 2) * v;
-                if (update > max_update) max_update = update;
-                update_resid_eta(r, eta, xMat, shift, row_idx, center[jj], scale[jj], n, jj); // update r
-                sumResid = sum(r, n); // update temp result w * r, used for computing xwr;
-                a[j] = beta(j, l); // update a
-              }
+          for (int h = 0; h < e1.size(); h++) {
+            j = e1.idx[h];
+            jj = col_idx[j];
+            xwr = 0.25 * crossprod_resid(xMat, r, sumResid, row_idx, center[jj], scale[jj], n, jj);
+            v = 0.25; // x^T * W * x / n = w = 0.25
+            // xwr = wcrossprod_resid(xMat, r, sumWResid, row_idx, center[j], scale[j], w, n, j);
+            // v = wsqsum_bm(xMat, w, row_idx, center[j], scale[j], n, j) / n;
+            u = xwr / n + v * a[j];
+            l1 = lambda[l] * m[jj] * alpha;
+            l2 = lambda[l] * m[jj] * (1 - alpha);
+            beta(j, l) = lasso(u, l1, l2, v);
+            
+            shift = beta(j, l) - a[j];
+            if (shift !=0) {
+              // update change of objective function
+              // update = - u * shift + (0.5 * v + 0.5 * l2) * (pow(beta(j, l), 2) - pow(a[j], 2)) + l1 * (fabs(beta(j, l)) - fabs(a[j]));
+              update = pow(beta(j, l) - a[j], 2) * v;
+              if (update > max_update) max_update = update;
+              update_resid_eta(r, eta, xMat, shift, row_idx, center[jj], scale[jj], n, jj); // update r
+              sumResid = sum(r, n); // update temp result w * r, used for computing xwr;
+              a[j] = beta(j, l); // update a
             }
           }
           // Check for convergence
@@ -696,7 +804,6 @@ RcppExport SEXP cdfit_binomial_ssr_approx(SEXP X_, SEXP y_, SEXP row_idx_,
     }
   }
   
-  Free(s); Free(w); Free(a); Free(r); Free(e1); Free(e2); Free(eta);
   return List::create(beta0, beta, center, scale, lambda, Dev, iter, n_reject, Rcpp::wrap(col_idx));
 }
 
@@ -707,8 +814,7 @@ RcppExport SEXP cdfit_binomial_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEXP yl
                                           SEXP alpha_, SEXP user_, 
                                           SEXP eps_, SEXP max_iter_, SEXP multiplier_, 
                                           SEXP dfmax_, SEXP ncore_, SEXP warn_,
-                                          SEXP safe_thresh_, SEXP verbose_) {
-  //ProfilerStart("Slores.out");
+                                          SEXP safe_thresh_, SEXP verbose_, SEXP io_) {
   XPtr<BigMatrix> xMat(X_);
   double *y = REAL(y_);
   int n_pos = INTEGER(n_pos_)[0];
@@ -757,6 +863,9 @@ RcppExport SEXP cdfit_binomial_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEXP yl
   omp_set_num_threads(useCores);
 #endif
   
+  ProfileFit pf(n, L);
+  IoOptions io(io_);
+  
   if (verbose) {
     char buff1[100];
     time_t now1 = time (0);
@@ -778,13 +887,13 @@ RcppExport SEXP cdfit_binomial_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEXP yl
   }
   
   arma::sp_mat beta = arma::sp_mat(p, L); //beta
-  double *a = Calloc(p, double); //Beta from previous iteration
+  WorkBuf<double> a(p); //Beta from previous iteration
   double a0 = 0.0; //beta0 from previousiteration
-  double *w = Calloc(n, double);
-  double *s = Calloc(n, double); //y_i - pi_i
-  double *eta = Calloc(n, double);
-  int *e1 = Calloc(p, int); //ever-active set
-  int *e2 = Calloc(p, int); //strong set
+  WorkBuf<double> w(n);
+  WorkBuf<double> s(n); //y_i - pi_i
+  WorkBuf<double> eta(n);
+  IndexSet e1(p); // ever-active set
+  IndexSet e2(p); // strong set
   double xwr, xwx, pi, u, v, cutoff, l1, l2, shift, si;
   double max_update, update, thresh; // for convergence check
   int i, j, jj, l, violations, lstart;
@@ -792,7 +901,7 @@ RcppExport SEXP cdfit_binomial_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEXP yl
   double ybar = sum(y, n) / n;
   a0 = beta0[0] = log(ybar / (1-ybar));
   double nullDev = 0;
-  double *r = Calloc(n, double);
+  WorkBuf<double> r(n);
   for (i = 0; i < n; i++) {
     r[i] = y[i];
     nullDev = nullDev - y[i]*log(ybar) - (1-y[i])*log(1-ybar);
@@ -836,9 +945,9 @@ RcppExport SEXP cdfit_binomial_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEXP yl
   vector<double> X_theta_lam_xi_pos; 
   vector<double> prod_PX_Pxmax_xi_pos;
   vector<double> cutoff_xi_pos;
-  int *slores_reject = Calloc(p, int);
-  int *slores_reject_old = Calloc(p, int);
-  for (int j = 0; j < p; j++) slores_reject_old[j] = 1;
+  BitSet slores_reject(p);
+  BitSet slores_reject_old(p);
+  slores_reject_old.set_all();
   
   int slores; // if 0, don't perform Slores rule
   if (slores_thresh < 1) {
@@ -859,6 +968,7 @@ RcppExport SEXP cdfit_binomial_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEXP yl
   if (slores == 1 && user == 0) n_slores_reject[0] = p;
   
   for (l = lstart; l < L; l++) {
+    prof_lambda(l);
     if(verbose) {
       // output time
       char buff[100];
@@ -870,16 +980,11 @@ RcppExport SEXP cdfit_binomial_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEXP yl
     if (l != 0) {
       // Check dfmax
       int nv = 0;
-      for (j = 0; j < p; j++) {
-        if (a[j] != 0) {
-          nv++;
-        }
+      for (int h = 0; h < e1.size(); h++) {
+        if (a[e1.idx[h]] != 0) nv++;
       }
       if (nv > dfmax) {
         for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
-        Free(slores_reject); Free(slores_reject_old);
-        Free(s); Free(w); Free(a); Free(r); Free(e1); Free(e2); Free(eta);
-        //ProfilerStop();
         return List::create(beta0, beta, center, scale, lambda, Dev, 
                             iter, n_reject, Rcpp::wrap(col_idx));
       }
@@ -893,40 +998,38 @@ RcppExport SEXP cdfit_binomial_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEXP yl
                     X_theta_lam_xi_pos, prod_PX_Pxmax_xi_pos, cutoff_xi_pos,
                     row_idx, col_idx, center, scale, xmax_idx, ylabel, 
                     lambda[l], lambda_max, n_pos, n, p);
-      n_slores_reject[l] = sum(slores_reject, p);
+      n_slores_reject[l] = slores_reject.count();
       
       // update z[j] for features which are rejected at previous lambda but accepted at current one.
       update_zj(z, slores_reject, slores_reject_old, xMat, row_idx, col_idx, center, scale, sumS, s, m, n, p);
       
-#pragma omp parallel for private(j) schedule(static) 
+      slores_reject_old = slores_reject;
+      e2.clear();
       for (j = 0; j < p; j++) {
-        slores_reject_old[j] = slores_reject[j];
         // hsr screening
         // if (slores_reject[j] == 0 && (fabs(z[j]) > (cutoff * alpha * m[col_idx[j]]))) {
         if (fabs(z[j]) > (cutoff * alpha * m[col_idx[j]])) {
-          e2[j] = 1;
-        } else {
-          e2[j] = 0;
+          e2.add(j);
         }
       }
     } else {
       n_slores_reject[l] = 0; 
       // hsr screening over all
-#pragma omp parallel for private(j) schedule(static) 
+      e2.clear();
       for (j = 0; j < p; j++) {
         if (fabs(z[j]) > (cutoff * alpha * m[col_idx[j]])) {
-          e2[j] = 1;
-        } else {
-          e2[j] = 0;
+          e2.add(j);
         }
       }
     }
-    n_reject[l] = p - sum(e2, p);
+    n_reject[l] = p - e2.size();
     
+    prof_phase(PH_SWEEP);
     while (iter[l] < max_iter) {
       while (iter[l] < max_iter) {
         while (iter[l] < max_iter) {
           iter[l]++;
+          prof_sweep();
           Dev[l] = 0.0;
           
           for (i = 0; i < n; i++) {
@@ -952,8 +1055,6 @@ RcppExport SEXP cdfit_binomial_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEXP yl
           if (Dev[l] / nullDev < .01) {
             if (warn) warning("Model saturated; exiting...");
             for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
-            Free(slores_reject); Free(slores_reject_old);
-            Free(s); Free(w); Free(a); Free(r); Free(e1); Free(e2); Free(eta);
             return List::create(beta0, beta, center, scale, lambda, Dev, iter, n_reject, n_slores_reject, Rcpp::wrap(col_idx));
           }
           // Intercept
@@ -970,26 +1071,25 @@ RcppExport SEXP cdfit_binomial_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEXP yl
           }
           sumWResid = wsum(r, w, n); // update temp result: sum of w * r, used for computing xwr;
           max_update = 0.0;
-          for (j = 0; j < p; j++) {
-            if (e1[j]) {
-              jj = col_idx[j];
-              xwr = wcrossprod_resid(xMat, r, sumWResid, row_idx, center[jj], scale[jj], w, n, jj);
-              v = wsqsum_bm(xMat, w, row_idx, center[jj], scale[jj], n, jj) / n;
-              u = xwr/n + v * a[j];
-              l1 = lambda[l] * m[jj] * alpha;
-              l2 = lambda[l] * m[jj] * (1-alpha);
-              beta(j, l) = lasso(u, l1, l2, v);
-              
-              shift = beta(j, l) - a[j];
-              if (shift != 0) {
-                // update change of objective function
-                // update = - u * shift + (0.5 * v + 0.5 * l2) * (pow(beta(j, l), 2) - pow(a[j], 2)) + l1 * (fabs(beta(j, l)) - fabs(a[j]));
-                update = pow(beta(j, l) - a[j], 2) * v;
-                if (update > max_update) max_update = update;
-                update_resid_eta(r, eta, xMat, shift, row_idx, center[jj], scale[jj], n, jj); // update r
-                sumWResid = wsum(r, w, n); // update temp result w * r, used for computing xwr;
-                a[j] = beta(j, l); // update a
-              }
+          for (int h = 0; h < e1.size(); h++) {
+            j = e1.idx[h];
+            jj = col_idx[j];
+            xwr = wcrossprod_resid(xMat, r, sumWResid, row_idx, center[jj], scale[jj], w, n, jj);
+            v = wsqsum_bm(xMat, w, row_idx, center[jj], scale[jj], n, jj) / n;
+            u = xwr/n + v * a[j];
+            l1 = lambda[l] * m[jj] * alpha;
+            l2 = lambda[l] * m[jj] * (1-alpha);
+            beta(j, l) = lasso(u, l1, l2, v);
+            
+            shift = beta(j, l) - a[j];
+            if (shift != 0) {
+              // update change of objective function
+              // update = - u * shift + (0.5 * v + 0.5 * l2) * (pow(beta(j, l), 2) - pow(a[j], 2)) + l1 * (fabs(beta(j, l)) - fabs(a[j]));
+              update = pow(beta(j, l) - a[j], 2) * v;
+              if (update > max_update) max_update = update;
+              update_resid_eta(r, eta, xMat, shift, row_idx, center[jj], scale[jj], n, jj); // update r
+              sumWResid = wsum(r, w, n); // update temp result w * r, used for computing xwr;
+              a[j] = beta(j, l); // update a
             }
           }
           // Check for convergence
@@ -1012,9 +1112,6 @@ RcppExport SEXP cdfit_binomial_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEXP yl
       }
     }
   }
-  Free(slores_reject); Free(slores_reject_old);
-  Free(s); Free(w); Free(a); Free(r); Free(e1); Free(e2); Free(eta);
-  //ProfilerStop();
   return List::create(beta0, beta, center, scale, lambda, Dev, iter, n_reject, n_slores_reject, Rcpp::wrap(col_idx));
 }
 
@@ -1025,8 +1122,7 @@ RcppExport SEXP cdfit_binomial_ada_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEX
                                               SEXP alpha_, SEXP user_, 
                                               SEXP eps_, SEXP max_iter_, SEXP multiplier_, 
                                               SEXP dfmax_, SEXP ncore_, SEXP warn_,
-                                              SEXP safe_thresh_, SEXP update_thresh_, SEXP verbose_) {
-  //ProfilerStart("Slores-ada.out");
+                                              SEXP safe_thresh_, SEXP update_thresh_, SEXP verbose_, SEXP io_) {
   XPtr<BigMatrix> xMat(X_);
   double *y = REAL(y_);
   int n_pos = INTEGER(n_pos_)[0];
@@ -1076,6 +1172,9 @@ RcppExport SEXP cdfit_binomial_ada_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEX
   omp_set_num_threads(useCores);
 #endif
   
+  ProfileFit pf(n, L);
+  IoOptions io(io_);
+  
   if (verbose) {
     char buff1[100];
     time_t now1 = time (0);
@@ -1097,13 +1196,13 @@ RcppExport SEXP cdfit_binomial_ada_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEX
   }
   
   arma::sp_mat beta = arma::sp_mat(p, L); //beta
-  double *a = Calloc(p, double); //Beta from previous iteration
+  WorkBuf<double> a(p); //Beta from previous iteration
   double a0 = 0.0; //beta0 from previousiteration
-  double *w = Calloc(n, double);
-  double *s = Calloc(n, double); //y_i - pi_i
-  double *eta = Calloc(n, double);
-  int *e1 = Calloc(p, int); //ever-active set
-  int *e2 = Calloc(p, int); //strong set
+  WorkBuf<double> w(n);
+  WorkBuf<double> s(n); //y_i - pi_i
+  WorkBuf<double> eta(n);
+  IndexSet e1(p); // ever-active set
+  IndexSet e2(p); // strong set
   double xwr, xwx, pi, u, v, cutoff, l1, l2, shift, si;
   double max_update, update, thresh; // for convergence check
   int i, j, jj, l, violations, lstart;
@@ -1111,7 +1210,7 @@ RcppExport SEXP cdfit_binomial_ada_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEX
   double ybar = sum(y, n) / n;
   a0 = beta0[0] = log(ybar / (1-ybar));
   double nullDev = 0;
-  double *r = Calloc(n, double);
+  WorkBuf<double> r(n);
   for (i = 0; i < n; i++) {
     r[i] = y[i];
     nullDev = nullDev - y[i]*log(ybar) - (1-y[i])*log(1-ybar);
@@ -1155,9 +1254,9 @@ RcppExport SEXP cdfit_binomial_ada_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEX
   vector<double> X_theta_lam_xi_pos; 
   vector<double> prod_PX_Pxmax_xi_pos;
   vector<double> cutoff_xi_pos;
-  int *slores_reject = Calloc(p, int);
-  int *slores_reject_old = Calloc(p, int);
-  for (int j = 0; j < p; j++) slores_reject_old[j] = 1;
+  BitSet slores_reject(p);
+  BitSet slores_reject_old(p);
+  slores_reject_old.set_all();
   int l_prev = lstart;
   double gain = 0.0;
   int xmax_invalid = 0;
@@ -1183,6 +1282,7 @@ RcppExport SEXP cdfit_binomial_ada_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEX
   if (slores == 1 && user == 0) n_slores_reject[0] = p;
   
   for (l = lstart; l < L; l++) {
+    prof_lambda(l);
     if(verbose) {
       // output time
       char buff[100];
@@ -1194,16 +1294,11 @@ RcppExport SEXP cdfit_binomial_ada_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEX
     if (l != 0) {
       // Check dfmax
       int nv = 0;
-      for (j = 0; j < p; j++) {
-        if (a[j] != 0) {
-          nv++;
-        }
+      for (int h = 0; h < e1.size(); h++) {
+        if (a[e1.idx[h]] != 0) nv++;
       }
       if (nv > dfmax) {
         for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
-        Free(slores_reject); Free(slores_reject_old);
-        Free(s); Free(w); Free(a); Free(r); Free(e1); Free(e2); Free(eta);
-        //ProfilerStop();
         return List::create(beta0, beta, center, scale, lambda, Dev, 
                             iter, n_reject, Rcpp::wrap(col_idx));
       }
@@ -1231,7 +1326,7 @@ RcppExport SEXP cdfit_binomial_ada_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEX
                       X_theta_lam_xi_pos, prod_PX_Pxmax_xi_pos, cutoff_xi_pos,
                       row_idx, col_idx, center, scale, xmax_idx, ylabel, 
                       lambda[l], lambda[l_prev], n_pos, n, p);
-        n_slores_reject[l] = sum(slores_reject, p);
+        n_slores_reject[l] = slores_reject.count();
         gain = n_slores_reject[l];
         
       } else {
@@ -1239,7 +1334,7 @@ RcppExport SEXP cdfit_binomial_ada_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEX
                       X_theta_lam_xi_pos, prod_PX_Pxmax_xi_pos, cutoff_xi_pos,
                       row_idx, col_idx, center, scale, xmax_idx, ylabel, 
                       lambda[l], lambda[l_prev], n_pos, n, p);
-        n_slores_reject[l] = sum(slores_reject, p);
+        n_slores_reject[l] = slores_reject.count();
         gain += n_slores_reject[l];
         
         // update z[j] for features which are rejected at previous lambda but accepted at current one.
@@ -1247,35 +1342,33 @@ RcppExport SEXP cdfit_binomial_ada_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEX
       }
       
       
-#pragma omp parallel for private(j) schedule(static) 
+      slores_reject_old = slores_reject;
+      e2.clear();
       for (j = 0; j < p; j++) {
-        slores_reject_old[j] = slores_reject[j];
         // hsr screening
         // if (slores_reject[j] == 0 && (fabs(z[j]) > (cutoff * alpha * m[col_idx[j]]))) {
         if (fabs(z[j]) > (cutoff * alpha * m[col_idx[j]])) {
-          e2[j] = 1;
-        } else {
-          e2[j] = 0;
+          e2.add(j);
         }
       }
     } else {
       n_slores_reject[l] = 0; 
       // hsr screening over all
-#pragma omp parallel for private(j) schedule(static) 
+      e2.clear();
       for (j = 0; j < p; j++) {
         if (fabs(z[j]) > (cutoff * alpha * m[col_idx[j]])) {
-          e2[j] = 1;
-        } else {
-          e2[j] = 0;
+          e2.add(j);
         }
       }
     }
-    n_reject[l] = p - sum(e2, p);
+    n_reject[l] = p - e2.size();
     
+    prof_phase(PH_SWEEP);
     while (iter[l] < max_iter) {
       while (iter[l] < max_iter) {
         while (iter[l] < max_iter) {
           iter[l]++;
+          prof_sweep();
           Dev[l] = 0.0;
           
           for (i = 0; i < n; i++) {
@@ -1301,8 +1394,6 @@ RcppExport SEXP cdfit_binomial_ada_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEX
           if (Dev[l] / nullDev < .01) {
             if (warn) warning("Model saturated; exiting...");
             for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
-            Free(slores_reject); Free(slores_reject_old);
-            Free(s); Free(w); Free(a); Free(r); Free(e1); Free(e2); Free(eta);
             return List::create(beta0, beta, center, scale, lambda, Dev, iter, n_reject, n_slores_reject, Rcpp::wrap(col_idx));
           }
           // Intercept
@@ -1320,37 +1411,36 @@ RcppExport SEXP cdfit_binomial_ada_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEX
           sumWResid = wsum(r, w, n); // update temp result: sum of w * r, used for computing xwr;
           max_update = 0.0;
           beta_max = 0.0;
-          for (j = 0; j < p; j++) {
-            if (e1[j]) {
-              jj = col_idx[j];
-              xwr = wcrossprod_resid(xMat, r, sumWResid, row_idx, center[jj], scale[jj], w, n, jj);
-              v = wsqsum_bm(xMat, w, row_idx, center[jj], scale[jj], n, jj) / n;
-              u = xwr/n + v * a[j];
-              l1 = lambda[l] * m[jj] * alpha;
-              l2 = lambda[l] * m[jj] * (1-alpha);
-              beta(j, l) = lasso(u, l1, l2, v);
-              if(fabs(lasso(u, l1, l2, v)) > beta_max) {
-                beta_max = fabs(lasso(u, l1, l2, v));
-                beta_max_idx = jj;
-              }
-              if(jj == xmax_idx) {
-                if(fabs(u) < l1) {
-                  xmax_invalid = 1;
-                } else {
-                  xmax_invalid = 0;
-                }
-              }
-              shift = beta(j, l) - a[j];
-              if (shift != 0) {
-                // update change of objective function
-                // update = - u * shift + (0.5 * v + 0.5 * l2) * (pow(beta(j, l), 2) - pow(a[j], 2)) + l1 * (fabs(beta(j, l)) - fabs(a[j]));
-                update = pow(beta(j, l) - a[j], 2) * v;
-                if (update > max_update) max_update = update;
-                update_resid_eta(r, eta, xMat, shift, row_idx, center[jj], scale[jj], n, jj); // update r
-                sumWResid = wsum(r, w, n); // update temp result w * r, used for computing xwr;
-                a[j] = beta(j, l); // update a
+          for (int h = 0; h < e1.size(); h++) {
+            j = e1.idx[h];
+            jj = col_idx[j];
+            xwr = wcrossprod_resid(xMat, r, sumWResid, row_idx, center[jj], scale[jj], w, n, jj);
+            v = wsqsum_bm(xMat, w, row_idx, center[jj], scale[jj], n, jj) / n;
+            u = xwr/n + v * a[j];
+            l1 = lambda[l] * m[jj] * alpha;
+            l2 = lambda[l] * m[jj] * (1-alpha);
+            beta(j, l) = lasso(u, l1, l2, v);
+            if(fabs(lasso(u, l1, l2, v)) > beta_max) {
+              beta_max = fabs(lasso(u, l1, l2, v));
+              beta_max_idx = jj;
+            }
+            if(jj == xmax_idx) {
+              if(fabs(u) < l1) {
+                xmax_invalid = 1;
+              } else {
+                xmax_invalid = 0;
               }
             }
+            shift = beta(j, l) - a[j];
+            if (shift != 0) {
+              // update change of objective function
+              // update = - u * shift + (0.5 * v + 0.5 * l2) * (pow(beta(j, l), 2) - pow(a[j], 2)) + l1 * (fabs(beta(j, l)) - fabs(a[j]));
+              update = pow(beta(j, l) - a[j], 2) * v;
+              if (update > max_update) max_update = update;
+              update_resid_eta(r, eta, xMat, shift, row_idx, center[jj], scale[jj], n, jj); // update r
+              sumWResid = wsum(r, w, n); // update temp result w * r, used for computing xwr;
+              a[j] = beta(j, l); // update a
+            }
           }
           // Check for convergence
           if (max_update < thresh)  break;
@@ -1373,8 +1463,250 @@ RcppExport SEXP cdfit_binomial_ada_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEX
        }*/
     }
   }
-  Free(slores_reject); Free(slores_reject_old);
-  Free(s); Free(w); Free(a); Free(r); Free(e1); Free(e2); Free(eta);
-  //ProfilerStop();
   return List::create(beta0, beta, center, scale, lambda, Dev, iter, n_reject, n_slores_reject, Rcpp::wrap(col_idx));
-}
\ No newline at end of file
+}
+
+// Coordinate descent for logistic models with working set
+RcppExport SEXP cdfit_binomial_ws(SEXP X_, SEXP y_, SEXP row_idx_, 
+                                  SEXP lambda_, SEXP nlambda_, SEXP lam_scale_,
+                                  SEXP lambda_min_, SEXP alpha_, SEXP user_, SEXP eps_, 
+                                  SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
+                                  SEXP ncore_, SEXP warn_, SEXP verbose_, SEXP io_) {
+  XPtr<BigMatrix> xMat(X_);
+  double *y = REAL(y_);
+  int *row_idx = INTEGER(row_idx_);
+  double lambda_min = REAL(lambda_min_)[0];
+  double alpha = REAL(alpha_)[0];
+  int n = Rf_length(row_idx_); // number of observations used for fitting model
+  int p = xMat->ncol();
+  int L = INTEGER(nlambda_)[0];
+  int lam_scale = INTEGER(lam_scale_)[0];
+  double eps = REAL(eps_)[0];
+  int max_iter = INTEGER(max_iter_)[0];
+  double *m = REAL(multiplier_);
+  int dfmax = INTEGER(dfmax_)[0];
+  int warn = INTEGER(warn_)[0];
+  int user = INTEGER(user_)[0];
+  int verbose = INTEGER(verbose_)[0];
+  
+  NumericVector lambda(L);
+  NumericVector Dev(L);
+  IntegerVector iter(L);
+  IntegerVector n_reject(L);
+  NumericVector beta0(L);
+  NumericVector center(p);
+  NumericVector scale(p);
+  int p_keep = 0; // keep columns whose scale > 1e-6
+  int *p_keep_ptr = &p_keep;
+  vector<int> col_idx;
+  vector<double> z;
+  double lambda_max = 0.0;
+  double *lambda_max_ptr = &lambda_max;
+  int xmax_idx = 0;
+  int *xmax_ptr = &xmax_idx;
+  
+  // set up omp
+  int useCores = INTEGER(ncore_)[0];
+#ifdef BIGLASSO_OMP_H_
+  int haveCores = omp_get_num_procs();
+  if(useCores < 1) {
+    useCores = haveCores;
+  }
+  omp_set_dynamic(0);
+  omp_set_num_threads(useCores);
+#endif
+  
+  ProfileFit pf(n, L);
+  IoOptions io(io_);
+  
+  if (verbose) {
+    char buff1[100];
+    time_t now1 = time (0);
+    strftime (buff1, 100, "%Y-%m-%d %H:%M:%S.000", localtime (&now1));
+    Rprintf("\nPreprocessing start: %s\n", buff1);
+  }
+  
+  // standardize: get center, scale; get p_keep_ptr, col_idx; get z, lambda_max, xmax_idx;
+  standardize_and_get_residual(center, scale, p_keep_ptr, col_idx, z, lambda_max_ptr, xmax_ptr, xMat, 
+                               y, row_idx, lambda_min, alpha, n, p);
+  p = p_keep; // set p = p_keep, only loop over columns whose scale > 1e-6
+  
+  if (verbose) {
+    char buff1[100];
+    time_t now1 = time (0);
+    strftime (buff1, 100, "%Y-%m-%d %H:%M:%S.000", localtime (&now1));
+    Rprintf("Preprocessing end: %s\n", buff1);
+    Rprintf("\n-----------------------------------------------\n");
+  }
+  
+  arma::sp_mat beta = arma::sp_mat(p, L); //beta
+  WorkBuf<double> a(p); //Beta from previous iteration
+  double a0 = 0.0; //beta0 from previousiteration
+  WorkBuf<double> w(n);
+  WorkBuf<double> s(n); //y_i - pi_i
+  WorkBuf<double> eta(n);
+  IndexSet in_ws(p); // working set indicator
+  vector<int> ws, cand(p); //working set, candidate buffer
+  vector<double> c; //X_j' s / n over working set
+  double xwr, xwx, pi, u, v, l1, l2, shift, si;
+  double max_update, update, thresh; // for convergence check
+  int i, j, jj, k, l, violations, lstart;
+  int ws_min = 100, gap_freq = 10, ws_size, nws = 0;
+  
+  double ybar = sum(y, n) / n;
+  a0 = beta0[0] = log(ybar / (1-ybar));
+  double nullDev = 0;
+  WorkBuf<double> r(n);
+  for (i = 0; i < n; i++) {
+    r[i] = y[i];
+    nullDev = nullDev - y[i]*log(ybar) - (1-y[i])*log(1-ybar);
+    s[i] = y[i] - ybar;
+    eta[i] = a0;
+  }
+  thresh = eps * nullDev / n;
+  
+  double sumS = sum(s, n); // temp result sum of s
+  double sumWResid = 0.0; // temp result: sum of w * r
+  
+  // set up lambda
+  if (user == 0) {
+    if (lam_scale) { // set up lambda, equally spaced on log scale
+      double log_lambda_max = log(lambda_max);
+      double log_lambda_min = log(lambda_min*lambda_max);
+      
+      double delta = (log_lambda_max - log_lambda_min) / (L-1);
+      for (l = 0; l < L; l++) {
+        lambda[l] = exp(log_lambda_max - l * delta);
+      }
+    } else { // equally spaced on linear scale
+      double delta = (lambda_max - lambda_min*lambda_max) / (L-1);
+      for (l = 0; l < L; l++) {
+        lambda[l] = lambda_max - l * delta;
+      }
+    }
+    Dev[0] = nullDev;
+    lstart = 1;
+    n_reject[0] = p;
+  } else {
+    lstart = 0;
+    lambda = Rcpp::as<NumericVector>(lambda_);
+  }
+  
+  for (l = lstart; l < L; l++) {
+    prof_lambda(l);
+    if(verbose) {
+      // output time
+      char buff[100];
+      time_t now = time (0);
+      strftime (buff, 100, "%Y-%m-%d %H:%M:%S.000", localtime (&now));
+      Rprintf("Lambda %d. Now time: %s\n", l, buff);
+    }
+    
+    // Check dfmax; only the working set of the previous lambda can be nonzero
+    int nv = 0;
+    for (int h = 0; h < nws; h++) {
+      if (a[ws[h]] != 0) nv++;
+    }
+    if (l != 0 && nv > dfmax) {
+      for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
+      return List::create(beta0, beta, center, scale, lambda, Dev, 
+                          iter, n_reject, Rcpp::wrap(col_idx));
+    }
+    // working set: active features plus those closest to violating KKT
+    ws_size = 2 * nv > ws_min ? 2 * nv : ws_min;
+    nws = ws_select(ws, in_ws, cand, z, a, col_idx, m, lambda[l], alpha, ws_size, p);
+    
+    prof_phase(PH_SWEEP);
+    while (iter[l] < max_iter) {
+      while (iter[l] < max_iter) {
+        iter[l]++;
+        prof_sweep();
+        Dev[l] = 0.0;
+        
+        for (i = 0; i < n; i++) {
+          if (eta[i] > 10) {
+            pi = 1;
+            w[i] = .0001;
+          } else if (eta[i] < -10) {
+            pi = 0;
+            w[i] = .0001;
+          } else {
+            pi = exp(eta[i]) / (1 + exp(eta[i]));
+            w[i] = pi * (1 - pi);
+          }
+          s[i] = y[i] - pi;
+          r[i] = s[i] / w[i];
+          if (y[i] == 1) {
+            Dev[l] = Dev[l] - log(pi);
+          } else {
+            Dev[l] = Dev[l] - log(1-pi);
+          }
+        }
+        
+        if (Dev[l] / nullDev < .01) {
+          if (warn) warning("Model saturated; exiting...");
+          for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
+          return List::create(beta0, beta, center, scale, lambda, Dev,
+                              iter, n_reject, Rcpp::wrap(col_idx));
+        }
+        
+        // duality gap on the working set, checked every gap_freq iterations
+        if (iter[l] % gap_freq == 0) {
+          sumS = sum(s, n);
+          ws_crossprod(c, ws, xMat, s, sumS, row_idx, col_idx, center, scale, n);
+          if (gap_binomial(s, y, Dev[l], a, c, ws, col_idx, m, lambda[l], alpha, n) < thresh) break;
+        }
+        
+        // Intercept
+        xwr = crossprod(w, r, n, 0);
+        xwx = sum(w, n);
+        beta0[l] = xwr / xwx + a0;
+        si = beta0[l] - a0;
+        if (si != 0) {
+          a0 = beta0[l];
+          for (i = 0; i < n; i++) {
+            r[i] -= si; //update r
+            eta[i] += si; //update eta
+          }
+        }
+        sumWResid = wsum(r, w, n); // update temp result: sum of w * r, used for computing xwr;
+        
+        max_update = 0.0;
+        for (k = 0; k < nws; k++) {
+          j = ws[k];
+          jj = col_idx[j];
+          xwr = wcrossprod_resid(xMat, r, sumWResid, row_idx, center[jj], scale[jj], w, n, jj);
+          v = wsqsum_bm(xMat, w, row_idx, center[jj], scale[jj], n, jj) / n;
+          u = xwr/n + v * a[j];
+          l1 = lambda[l] * m[jj] * alpha;
+          l2 = lambda[l] * m[jj] * (1-alpha);
+          beta(j, l) = lasso(u, l1, l2, v);
+          
+          shift = beta(j, l) - a[j];
+          if (shift !=0) {
+            update = pow(beta(j, l) - a[j], 2) * v;
+            if (update > max_update) max_update = update;
+            update_resid_eta(r, eta, xMat, shift, row_idx, center[jj], scale[jj], n, jj); // update r
+            sumWResid = wsum(r, w, n); // update temp result w * r, used for computing xwr;
+            a[j] = beta(j, l); // update a
+          }
+        }
+        // Check for convergence
+        if (max_update < thresh)  break;
+      }
+      // Scan for violations outside working set
+      sumS = sum(s, n);
+      violations = check_rest_set(in_ws, in_ws, z, xMat, row_idx, col_idx, center, scale, a, lambda[l], sumS, alpha, s, m, n, p);
+      if (violations==0) break;
+      // grow working set, violators have the smallest margins
+      ws_size = 2 * nws > nws + violations ? 2 * nws : nws + violations;
+      nws = ws_select(ws, in_ws, cand, z, a, col_idx, m, lambda[l], alpha, ws_size, p);
+    }
+    n_reject[l] = p - nws;
+    // refresh z over the working set for selection at next lambda
+    ws_crossprod(c, ws, xMat, s, sumS, row_idx, col_idx, center, scale, n);
+    for (k = 0; k < nws; k++) z[ws[k]] = c[k];
+  }
+  return List::create(beta0, beta, center, scale, lambda, Dev, iter, n_reject, Rcpp::wrap(col_idx));
+  
+}
@@ -8,13 +8,12 @@ void standardize_and_get_residual_cox(NumericVector &center, NumericVector &scal
                                       int *xmax_ptr, XPtr<BigMatrix> xMat, 
                                       double *y, double *d, int *d_idx, int *row_idx,
                                       double lambda_min, double alpha, int n, int f, int p) {
-  MatrixAccessor<double> xAcc(*xMat);
   double *xCol;
-  double sum_xs;
+  vector<double> sum_xs(p);
   double zmax = 0.0, zj = 0.0;
-  int i, j, k;
-  double *s = Calloc(n, double);
-  double *rsk = Calloc(f, double);
+  int i, j, k, nb;
+  WorkBuf<double> s(n);
+  WorkBuf<double> rsk(f);
   
   rsk[0] = n;
   k = 0;
@@ -33,22 +32,34 @@ void standardize_and_get_residual_cox(NumericVector &center, NumericVector &scal
     }
   }
   
-  for (j = 0; j < p; j++) {
-    xCol = xAcc[j];
-    sum_xs = 0.0;
-    
-    for (i = 0; i < n; i++) {
-      center[j] += xCol[row_idx[i]];
-      scale[j] += pow(xCol[row_idx[i]], 2);
-      sum_xs = sum_xs + xCol[row_idx[i]] * s[i];
+  // column moments and X's in one parallel pass, then the kept set serially
+  vector<int> all(p);
+  for (j = 0; j < p; j++) all[j] = j;
+  ColumnStream cs(xMat, all, NULL, p);
+  prof_reads(p);
+  while (cs.next()) {
+    nb = cs.size();
+#pragma omp parallel for private(i, j, k, xCol) schedule(static)
+    for (k = 0; k < nb; k++) {
+      j = cs.col(k);
+      xCol = cs.data(k);
+      sum_xs[j] = 0.0;
+      
+      for (i = 0; i < n; i++) {
+        center[j] += xCol[row_idx[i]];
+        scale[j] += pow(xCol[row_idx[i]], 2);
+        sum_xs[j] = sum_xs[j] + xCol[row_idx[i]] * s[i];
+      }
+      
+      center[j] = center[j] / n; //center
+      scale[j] = sqrt(scale[j] / n - pow(center[j], 2)); //scale
     }
-    
-    center[j] = center[j] / n; //center
-    scale[j] = sqrt(scale[j] / n - pow(center[j], 2)); //scale
-    
+  }
+  
+  for (j = 0; j < p; j++) {
     if (scale[j] > 1e-6) {
       col_idx.push_back(j);
-      zj = sum_xs / (scale[j] * n); 
+      zj = sum_xs[j] / (scale[j] * n); 
       if (fabs(zj) > zmax) {
         zmax = fabs(zj);
         *xmax_ptr = j; // xmax_ptr is the index in the raw xMat, not index in col_idx!
@@ -58,8 +69,6 @@ void standardize_and_get_residual_cox(NumericVector &center, NumericVector &scal
   }
   *p_keep_ptr = col_idx.size();
   *lambda_max_ptr = zmax / alpha;
-  Free(s);
-  Free(rsk);
 }
 
 // dual function g(lambda/lambda_0*Theta)
@@ -88,7 +97,7 @@ void scox_init(double *g_theta_lam_ptr, double *prod_deriv_theta_lam_ptr,
                int *row_idx, vector<int> &col_idx,
                NumericVector &center, NumericVector &scale,
                int n, int p, int f, double *y, double *d, int *d_idx) {
-  
+  ProfilePhase ph(PH_SAFE);
   *g_theta_lam_ptr = dual_cox(haz, rsk, 1.0, 1.0, n, f, y, d, d_idx);
   double prod_deriv_theta_lam = 0.0;
   int i, k;
@@ -108,7 +117,8 @@ void scox_init(double *g_theta_lam_ptr, double *prod_deriv_theta_lam_ptr,
   double max_x, min_x;
   double *xmax = xAcc[col_idx[xmax_col_idx]];
   double scale_max = scale[col_idx[xmax_col_idx]];
-  double *diff_xmax = Calloc(f, double);
+  WorkBuf<double> diff_xmax(f);
+  prof_reads(p + 1);
   
   // Initialize ||xmax||_{diff,k}
   i = n-1;
@@ -142,11 +152,10 @@ void scox_init(double *g_theta_lam_ptr, double *prod_deriv_theta_lam_ptr,
     scaleP_X[j] = sqrt(scaleP_X[j]) / scale[jj] / 2;
     prodP_X_xmax[j] = prodP_X_xmax[j] / scale[jj] / scale_max / 4;
   }
-  Free(diff_xmax);
 }
 
 // Scox screening
-void scox_screen(int* scox_reject, double lambda, double lambda_0,
+void scox_screen(BitSet &scox_reject, double lambda, double lambda_0,
                  double *haz, double *rsk, double g_theta_lam,
                  double prod_deriv_theta_lam, vector<double>& prodP_X_xmax,
                  vector<double>& scaleP_X, vector<double>& X_theta_lam,
@@ -161,45 +170,48 @@ void scox_screen(int* scox_reject, double lambda, double lambda_0,
   double D = n * (lambda_0 - lambda) / r / scaleP_Xmax;
   double a2 = (1 - pow(D, 2)) * pow(scaleP_Xmax, 4);
   double a1, a0, Delta, u2, rho, T;
-  int j;
+  int b, j, nw = scox_reject.nwords();
   
-#pragma omp parallel for private(j, a1, a0, Delta, u2, rho, T) schedule(static)
-  for (j = 0; j < p; j++) {
-    // xi=1
-    scox_reject[j] = 1;
-    rho = prodP_X_xmax[j] / scaleP_Xmax / scaleP_X[j];
-    a1 = 2 * (1 - pow(D, 2)) * prodP_X_xmax[j] * pow(scaleP_Xmax, 2);
-    a0 = pow(prodP_X_xmax[j], 2) - pow(D * scaleP_Xmax * scaleP_X[j], 2);
-    Delta = pow(a1, 2) - 4 * a0 * a2;
-    if (Delta < 0.0) Delta = 0.0; // in case of -0.0 (at xmax)
-    u2 = (-a1 + sqrt(Delta)) / 2 / a2;
-    if(j==p-1) Rprintf("rho=%f, Delta=%f, u2=%f\n", rho, Delta, u2);
-    if(rho >= D) {
-      T = X_theta_lam[j] + r * scaleP_X[j] / n;
-      if(j==p-1) Rprintf("T+[%i]/lam=%f+%f*%f/%f\n", j, X_theta_lam[j], r/sqrt(n), scaleP_X[j]/sqrt(n), lambda);
+  // each thread owns whole 64-bit words of the mask
+#pragma omp parallel for private(b, j, a1, a0, Delta, u2, rho, T) schedule(static)
+  for (b = 0; b < nw; b++) {
+    for (j = b * 64; j < p && j < (b + 1) * 64; j++) {
+      // xi=1
+      scox_reject.set(j);
+      rho = prodP_X_xmax[j] / scaleP_Xmax / scaleP_X[j];
+      a1 = 2 * (1 - pow(D, 2)) * prodP_X_xmax[j] * pow(scaleP_Xmax, 2);
+      a0 = pow(prodP_X_xmax[j], 2) - pow(D * scaleP_Xmax * scaleP_X[j], 2);
+      Delta = pow(a1, 2) - 4 * a0 * a2;
+      if (Delta < 0.0) Delta = 0.0; // in case of -0.0 (at xmax)
+      u2 = (-a1 + sqrt(Delta)) / 2 / a2;
+      if(j==p-1) Rprintf("rho=%f, Delta=%f, u2=%f\n", rho, Delta, u2);
+      if(rho >= D) {
+        T = X_theta_lam[j] + r * scaleP_X[j] / n;
+        if(j==p-1) Rprintf("T+[%i]/lam=%f+%f*%f/%f\n", j, X_theta_lam[j], r/sqrt(n), scaleP_X[j]/sqrt(n), lambda);
       
-    } else {
-      T = X_theta_lam[j] - u2 * (lambda_0 - lambda) +
-        r * sqrt(pow(scaleP_X[j],2) + 2 * u2 * prodP_X_xmax[j] + pow(u2 * scaleP_Xmax, 2)) / n;
-      if(j==p-1) Rprintf("T+[%i]/lam=%f+%f+%f*%f/%f\n", j, X_theta_lam[j], -u2 * (lambda_0 - lambda), r/sqrt(n), sqrt(pow(scaleP_X[j],2) + 2 * u2 * prodP_X_xmax[j] + pow(u2 * scaleP_Xmax, 2))/sqrt(n), lambda);
-    }
-    if(T + TOLERANCE > lambda) {
-      scox_reject[j] = 0;
-    }
-    // xi=-1
-    //rho = -rho;
-    //a1 = -a1;
-    //u2 = (-a1 + sqrt(Delta)) / 2 / a2;
-    if(rho >= D) {
-      T = -X_theta_lam[j] + r * scaleP_X[j] / n;
-      if(j==p-1) Rprintf("T-[%i]/lam=%f+%f*%f/%f\n", j, -X_theta_lam[j], r/sqrt(n), scaleP_X[j]/sqrt(n), lambda);
-    } else {
-      T = -X_theta_lam[j] - u2 * (lambda_0 - lambda) +
-        r * sqrt(pow(scaleP_X[j],2) + 2 * u2 * prodP_X_xmax[j] + pow(u2 * scaleP_Xmax, 2)) / n;
-      if(j==p-1) Rprintf("T-[%i]/lam=%f+%f+%f*%f/%f\n", j, -X_theta_lam[j], -u2 * (lambda_0 - lambda), r/sqrt(n), sqrt(pow(scaleP_X[j],2) + 2 * u2 * prodP_X_xmax[j] + pow(u2 * scaleP_Xmax, 2))/sqrt(n), lambda);
-    }
-    if(T + TOLERANCE > lambda) {
-      scox_reject[j] = 0;
+      } else {
+        T = X_theta_lam[j] - u2 * (lambda_0 - lambda) +
+          r * sqrt(pow(scaleP_X[j],2) + 2 * u2 * prodP_X_xmax[j] + pow(u2 * scaleP_Xmax, 2)) / n;
+        if(j==p-1) Rprintf("T+[%i]/lam=%f+%f+%f*%f/%f\n", j, X_theta_lam[j], -u2 * (lambda_0 - lambda), r/sqrt(n), sqrt(pow(scaleP_X[j],2) + 2 * u2 * prodP_X_xmax[j] + pow(u2 * scaleP_Xmax, 2))/sqrt(n), lambda);
+      }
+      if(T + TOLERANCE > lambda) {
+        scox_reject.reset(j);
+      }
+      // xi=-1
+      //rho = -rho;
+      //a1 = -a1;
+      //u2 = (-a1 + sqrt(Delta)) / 2 / a2;
+      if(rho >= D) {
+        T = -X_theta_lam[j] + r * scaleP_X[j] / n;
+        if(j==p-1) Rprintf("T-[%i]/lam=%f+%f*%f/%f\n", j, -X_theta_lam[j], r/sqrt(n), scaleP_X[j]/sqrt(n), lambda);
+      } else {
+        T = -X_theta_lam[j] - u2 * (lambda_0 - lambda) +
+          r * sqrt(pow(scaleP_X[j],2) + 2 * u2 * prodP_X_xmax[j] + pow(u2 * scaleP_Xmax, 2)) / n;
+        if(j==p-1) Rprintf("T-[%i]/lam=%f+%f+%f*%f/%f\n", j, -X_theta_lam[j], -u2 * (lambda_0 - lambda), r/sqrt(n), sqrt(pow(scaleP_X[j],2) + 2 * u2 * prodP_X_xmax[j] + pow(u2 * scaleP_Xmax, 2))/sqrt(n), lambda);
+      }
+      if(T + TOLERANCE > lambda) {
+        scox_reject.reset(j);
+      }
     }
   }
 }
@@ -209,7 +221,7 @@ RcppExport SEXP cdfit_cox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_idx_,
                           SEXP lambda_, SEXP nlambda_, SEXP lam_scale_,
                           SEXP lambda_min_, SEXP alpha_, SEXP user_, SEXP eps_, 
                           SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
-                          SEXP ncore_, SEXP warn_, SEXP verbose_) {
+                          SEXP ncore_, SEXP warn_, SEXP verbose_, SEXP io_) {
   XPtr<BigMatrix> xMat(X_);
   double *y = REAL(y_); // Failure indicator for subjects
   double *d = REAL(d_); // Number of failure at unique failure times
@@ -256,6 +268,9 @@ RcppExport SEXP cdfit_cox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_idx_,
   omp_set_num_threads(useCores);
 #endif
   
+  ProfileFit pf(n, L);
+  IoOptions io(io_);
+  
   if (verbose) {
     char buff1[100];
     time_t now1 = time (0);
@@ -277,18 +292,17 @@ RcppExport SEXP cdfit_cox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_idx_,
   }
   
   arma::sp_mat beta = arma::sp_mat(p, L); //beta
-  double *a = Calloc(p, double); //Beta from previous iteration
-  double *w = Calloc(n, double); //weights from diagnal of hessian matrix
-  double *s = Calloc(n, double); //y_i - yhat_i
-  double *r = Calloc(n, double); //s/w
-  double *eta = Calloc(n, double); //X\beta
-  double *haz = Calloc(n, double); //exp(eta)
-  double *rsk = Calloc(f, double); //Sum of hazard over at risk set
-  int *e1 = Calloc(p, int); //ever-active set
+  WorkBuf<double> a(p); //Beta from previous iteration
+  WorkBuf<double> w(n); //weights from diagnal of hessian matrix
+  WorkBuf<double> s(n); //y_i - yhat_i
+  WorkBuf<double> r(n); //s/w
+  WorkBuf<double> eta(n); //X\beta
+  WorkBuf<double> haz(n); //exp(eta)
+  WorkBuf<double> rsk(f); //Sum of hazard over at risk set
+  IndexSet e1(p); // ever-active set
   double xwr, xwx, u, v, l1, l2, shift;
   double max_update, update, thresh; // for convergence check
   int i, j, jj, k, l, violations, lstart;
-  for(j = 0; j < p; j++) e1[j] = 0;
   for(i = 0; i < n; i++) eta[i] = 0;
   double sumWResid = 0.0; //sum w*r
   
@@ -336,6 +350,7 @@ RcppExport SEXP cdfit_cox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_idx_,
   }
   
   for (l = lstart; l < L; l++) {
+    prof_lambda(l);
     if(verbose) {
       // output time
       char buff[100];
@@ -347,22 +362,21 @@ RcppExport SEXP cdfit_cox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_idx_,
     if (l != 0) {
       // Check dfmax
       int nv = 0;
-      for (j = 0; j < p; j++) {
-        if (a[j] != 0) {
-          nv++;
-        }
+      for (int h = 0; h < e1.size(); h++) {
+        if (a[e1.idx[h]] != 0) nv++;
       }
       if (nv > dfmax) {
         for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
-        Free(s); Free(w); Free(a); Free(r); Free(e1); Free(eta); Free(haz); Free(rsk);
         return List::create(beta, center, scale, lambda, Dev, 
                             iter, n_reject, Rcpp::wrap(col_idx));
       }
     }
     
+    prof_phase(PH_SWEEP);
     while (iter[l] < max_iter) {
       while (iter[l] < max_iter) {
         iter[l]++;
+        prof_sweep();
         Dev[l] = 0.0;
         
         // Calculate haz, rsk, Dev
@@ -385,7 +399,6 @@ RcppExport SEXP cdfit_cox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_idx_,
         if (Dev[l] / nullDev < .01) {
           if (warn) warning("Model saturated with deviance %f; exiting...", Dev[l]);
           for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
-          Free(s); Free(w); Free(a); Free(r); Free(e1); Free(eta); Free(haz); Free(rsk);
           return List::create(beta, center, scale, lambda, Dev,
                               iter, n_reject, Rcpp::wrap(col_idx));
         }
@@ -407,26 +420,25 @@ RcppExport SEXP cdfit_cox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_idx_,
         
         // Update beta
         max_update = 0.0;
-        for (j = 0; j < p; j++) {
-          if (e1[j]) {
-            jj = col_idx[j];
-            xwr = wcrossprod_resid(xMat, r, sumWResid, row_idx, center[jj], scale[jj], w, n, jj);
-            xwx = wsqsum_bm(xMat, w, row_idx, center[jj], scale[jj], n, jj);
-            u = xwr / n + xwx * a[j] / n;
-            v = xwx / n;
-            l1 = lambda[l] * m[jj] * alpha;
-            l2 = lambda[l] * m[jj] * (1-alpha);
-            beta(j, l) = lasso(u, l1, l2, v);
+        for (int h = 0; h < e1.size(); h++) {
+          j = e1.idx[h];
+          jj = col_idx[j];
+          xwr = wcrossprod_resid(xMat, r, sumWResid, row_idx, center[jj], scale[jj], w, n, jj);
+          xwx = wsqsum_bm(xMat, w, row_idx, center[jj], scale[jj], n, jj);
+          u = xwr / n + xwx * a[j] / n;
+          v = xwx / n;
+          l1 = lambda[l] * m[jj] * alpha;
+          l2 = lambda[l] * m[jj] * (1-alpha);
+          beta(j, l) = lasso(u, l1, l2, v);
+          
+          shift = beta(j, l) - a[j];
+          if (shift !=0) {
             
-            shift = beta(j, l) - a[j];
-            if (shift !=0) {
-              
-              update = pow(beta(j, l) - a[j], 2) * v;
-              if (update > max_update) max_update = update;
-              update_resid_eta(r, eta, xMat, shift, row_idx, center[jj], scale[jj], n, jj); // update r
-              sumWResid = wsum(r, w, n); // update temp result w * r, used for computing xwr;
-              a[j] = beta(j, l); // update a
-            }
+            update = pow(beta(j, l) - a[j], 2) * v;
+            if (update > max_update) max_update = update;
+            update_resid_eta(r, eta, xMat, shift, row_idx, center[jj], scale[jj], n, jj); // update r
+            sumWResid = wsum(r, w, n); // update temp result w * r, used for computing xwr;
+            a[j] = beta(j, l); // update a
           }
         }
         // Check for convergence
@@ -437,7 +449,6 @@ RcppExport SEXP cdfit_cox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_idx_,
       if (violations==0) break;
     }
   }
-  Free(s); Free(w); Free(a); Free(r); Free(e1); Free(eta); Free(haz); Free(rsk);
   return List::create(beta, center, scale, lambda, Dev, iter, n_reject, Rcpp::wrap(col_idx));
   
 }
@@ -447,7 +458,7 @@ RcppExport SEXP cdfit_cox_ssr(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_i
                               SEXP lambda_, SEXP nlambda_, SEXP lam_scale_,
                               SEXP lambda_min_, SEXP alpha_, SEXP user_, SEXP eps_, 
                               SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
-                              SEXP ncore_, SEXP warn_, SEXP verbose_) {
+                              SEXP ncore_, SEXP warn_, SEXP verbose_, SEXP io_) {
   XPtr<BigMatrix> xMat(X_);
   double *y = REAL(y_); // Failure indicator for subjects
   double *d = REAL(d_); // Number of failure at unique failure times
@@ -494,6 +505,9 @@ RcppExport SEXP cdfit_cox_ssr(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_i
   omp_set_num_threads(useCores);
 #endif
   
+  ProfileFit pf(n, L);
+  IoOptions io(io_);
+  
   if (verbose) {
     char buff1[100];
     time_t now1 = time (0);
@@ -515,19 +529,18 @@ RcppExport SEXP cdfit_cox_ssr(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_i
   }
   
   arma::sp_mat beta = arma::sp_mat(p, L); //beta
-  double *a = Calloc(p, double); //Beta from previous iteration
-  double *w = Calloc(n, double); //weights from diagnal of hessian matrix
-  double *s = Calloc(n, double); //y_i - yhat_i
-  double *r = Calloc(n, double); //s/w
-  double *eta = Calloc(n, double); //X\beta
-  double *haz = Calloc(n, double); //exp(eta)
-  double *rsk = Calloc(f, double); //Sum of hazard over at risk set
-  int *e1 = Calloc(p, int); //ever-active set
-  int *e2 = Calloc(p, int); //strong set
+  WorkBuf<double> a(p); //Beta from previous iteration
+  WorkBuf<double> w(n); //weights from diagnal of hessian matrix
+  WorkBuf<double> s(n); //y_i - yhat_i
+  WorkBuf<double> r(n); //s/w
+  WorkBuf<double> eta(n); //X\beta
+  WorkBuf<double> haz(n); //exp(eta)
+  WorkBuf<double> rsk(f); //Sum of hazard over at risk set
+  IndexSet e1(p); // ever-active set
+  IndexSet e2(p); // strong set
   double xwr, xwx, u, v, cutoff, l1, l2, shift;
   double max_update, update, thresh; // for convergence check
   int i, j, jj, k, l, violations, lstart;
-  for(j = 0; j < p; j++) e1[j] = 0;
   for(i = 0; i < n; i++) eta[i] = 0;
   double sumWResid = 0.0; //sum w*r
   
@@ -576,6 +589,7 @@ RcppExport SEXP cdfit_cox_ssr(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_i
   }
   
   for (l = lstart; l < L; l++) {
+    prof_lambda(l);
     if(verbose) {
       // output time
       char buff[100];
@@ -587,45 +601,42 @@ RcppExport SEXP cdfit_cox_ssr(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_i
     if (l != 0) {
       // Check dfmax
       int nv = 0;
-      for (j = 0; j < p; j++) {
-        if (a[j] != 0) {
-          nv++;
-        }
+      for (int h = 0; h < e1.size(); h++) {
+        if (a[e1.idx[h]] != 0) nv++;
       }
       if (nv > dfmax) {
         for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
-        Free(s); Free(w); Free(a); Free(r); Free(e1); Free(e2); Free(eta); Free(haz); Free(rsk);
         return List::create(beta, center, scale, lambda, Dev, 
                             iter, n_reject, Rcpp::wrap(col_idx));
       }
       
       // strong set
       cutoff = 2*lambda[l] - lambda[l-1];
+      e2.clear();
       for (j = 0; j < p; j++) {
         if (fabs(z[j]) > (cutoff * alpha * m[col_idx[j]])) {
-          e2[j] = 1;
-        } else {
-          e2[j] = 0;
+          e2.add(j);
         }
       }
       
     } else {
       // strong set
       cutoff = 2*lambda[l] - lambda_max;
+      e2.clear();
       for (j = 0; j < p; j++) {
         if (fabs(z[j]) > (cutoff * alpha * m[col_idx[j]])) {
-          e2[j] = 1;
-        } else {
-          e2[j] = 0;
+          e2.add(j);
         }
       }
     }
     
-    n_reject[l] = p - sum(e2, p);
+    n_reject[l] = p - e2.size();
+    prof_phase(PH_SWEEP);
     while (iter[l] < max_iter) {
       while (iter[l] < max_iter) {
         while (iter[l] < max_iter) {
           iter[l]++;
+          prof_sweep();
           Dev[l] = 0.0;
           
           // Calculate haz, rsk, Dev
@@ -648,7 +659,6 @@ RcppExport SEXP cdfit_cox_ssr(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_i
           if (Dev[l] / nullDev < .01) {
             if (warn) warning("Model saturated with deviance %f; exiting...", Dev[l]);
             for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
-            Free(s); Free(w); Free(a); Free(r); Free(e1); Free(e2); Free(eta); Free(haz); Free(rsk);
             return List::create(beta, center, scale, lambda, Dev,
                                 iter, n_reject, Rcpp::wrap(col_idx));
           }
@@ -670,26 +680,25 @@ RcppExport SEXP cdfit_cox_ssr(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_i
           
           // Update beta
           max_update = 0.0;
-          for (j = 0; j < p; j++) {
-            if (e1[j]) {
-              jj = col_idx[j];
-              xwr = wcrossprod_resid(xMat, r, sumWResid, row_idx, center[jj], scale[jj], w, n, jj);
-              xwx = wsqsum_bm(xMat, w, row_idx, center[jj], scale[jj], n, jj);
-              u = xwr / n + xwx * a[j] / n;
-              v = xwx / n;
-              l1 = lambda[l] * m[jj] * alpha;
-              l2 = lambda[l] * m[jj] * (1-alpha);
-              beta(j, l) = lasso(u, l1, l2, v);
+          for (int h = 0; h < e1.size(); h++) {
+            j = e1.idx[h];
+            jj = col_idx[j];
+            xwr = wcrossprod_resid(xMat, r, sumWResid, row_idx, center[jj], scale[jj], w, n, jj);
+            xwx = wsqsum_bm(xMat, w, row_idx, center[jj], scale[jj], n, jj);
+            u = xwr / n + xwx * a[j] / n;
+            v = xwx / n;
+            l1 = lambda[l] * m[jj] * alpha;
+            l2 = lambda[l] * m[jj] * (1-alpha);
+            beta(j, l) = lasso(u, l1, l2, v);
 
-              shift = beta(j, l) - a[j];
-              if (shift !=0) {
-                
-                update = pow(beta(j, l) - a[j], 2) * v;
-                if (update > max_update) max_update = update;
-                update_resid_eta(r, eta, xMat, shift, row_idx, center[jj], scale[jj], n, jj); // update r
-                sumWResid = wsum(r, w, n); // update temp result w * r, used for computing xwr;
-                a[j] = beta(j, l); // update a
-              }
+            shift = beta(j, l) - a[j];
+            if (shift !=0) {
+              
+              update = pow(beta(j, l) - a[j], 2) * v;
+              if (update > max_update) max_update = update;
+              update_resid_eta(r, eta, xMat, shift, row_idx, center[jj], scale[jj], n, jj); // update r
+              sumWResid = wsum(r, w, n); // update temp result w * r, used for computing xwr;
+              a[j] = beta(j, l); // update a
             }
           }
           // Check for convergence
@@ -704,7 +713,6 @@ RcppExport SEXP cdfit_cox_ssr(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_i
       if (violations==0) break;
     }
   }
-  Free(s); Free(w); Free(a); Free(r); Free(e1); Free(e2); Free(eta); Free(haz); Free(rsk);
   return List::create(beta, center, scale, lambda, Dev, iter, n_reject, Rcpp::wrap(col_idx));
   
 }
@@ -714,7 +722,7 @@ RcppExport SEXP cdfit_cox_scox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_
                                SEXP lambda_, SEXP nlambda_, SEXP lam_scale_,
                                SEXP lambda_min_, SEXP alpha_, SEXP user_, SEXP eps_, 
                                SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
-                               SEXP ncore_, SEXP warn_, SEXP safe_thresh_, SEXP verbose_) {
+                               SEXP ncore_, SEXP warn_, SEXP safe_thresh_, SEXP verbose_, SEXP io_) {
   XPtr<BigMatrix> xMat(X_);
   double *y = REAL(y_); // Failure indicator for subjects
   double *d = REAL(d_); // Number of failure at unique failure times
@@ -762,6 +770,9 @@ RcppExport SEXP cdfit_cox_scox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_
   omp_set_num_threads(useCores);
 #endif
   
+  ProfileFit pf(n, L);
+  IoOptions io(io_);
+  
   if (verbose) {
     char buff1[100];
     time_t now1 = time (0);
@@ -783,18 +794,17 @@ RcppExport SEXP cdfit_cox_scox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_
   }
   
   arma::sp_mat beta = arma::sp_mat(p, L); //beta
-  double *a = Calloc(p, double); //Beta from previous iteration
-  double *w = Calloc(n, double); //weights from diagnal of hessian matrix
-  double *s = Calloc(n, double); //y_i - yhat_i
-  double *r = Calloc(n, double); //s/w
-  double *eta = Calloc(n, double); //X\beta
-  double *haz = Calloc(n, double); //exp(eta)
-  double *rsk = Calloc(f, double); //Sum of hazard over at risk set
-  int *e1 = Calloc(p, int); //ever-active set
+  WorkBuf<double> a(p); //Beta from previous iteration
+  WorkBuf<double> w(n); //weights from diagnal of hessian matrix
+  WorkBuf<double> s(n); //y_i - yhat_i
+  WorkBuf<double> r(n); //s/w
+  WorkBuf<double> eta(n); //X\beta
+  WorkBuf<double> haz(n); //exp(eta)
+  WorkBuf<double> rsk(f); //Sum of hazard over at risk set
+  IndexSet e1(p); // ever-active set
   double xwr, xwx, u, v, cutoff, l1, l2, shift;
   double max_update, update, thresh; // for convergence check
   int i, j, jj, k, l, violations, lstart;
-  for(j = 0; j < p; j++) e1[j] = 0;
   for(i = 0; i < n; i++) {
     eta[i] = 0;
     haz[i] = 1;
@@ -853,7 +863,7 @@ RcppExport SEXP cdfit_cox_scox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_
   vector<double> X_theta_lam; 
   vector<double> prodP_X_xmax;
   vector<double> scaleP_X;
-  int *safe_reject = Calloc(p, int);
+  BitSet safe_reject(p);
   
   int scox; // if 0, don't perform Scox rule
   if (safe_thresh < 1) {
@@ -872,6 +882,7 @@ RcppExport SEXP cdfit_cox_scox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_
   if (scox == 1 && user == 0) n_reject[0] = p;
   
   for (l = lstart; l < L; l++) {
+    prof_lambda(l);
     if(verbose) {
       // output time
       char buff[100];
@@ -883,14 +894,11 @@ RcppExport SEXP cdfit_cox_scox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_
     if (l != 0) {
       // Check dfmax
       int nv = 0;
-      for (j = 0; j < p; j++) {
-        if (a[j] != 0) {
-          nv++;
-        }
+      for (int h = 0; h < e1.size(); h++) {
+        if (a[e1.idx[h]] != 0) nv++;
       }
       if (nv > dfmax) {
         for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
-        Free(s); Free(w); Free(a); Free(r); Free(e1); Free(safe_reject); Free(eta); Free(haz); Free(rsk);
         return List::create(beta, center, scale, lambda, Dev, 
                             iter, n_reject, Rcpp::wrap(col_idx));
       }
@@ -901,10 +909,12 @@ RcppExport SEXP cdfit_cox_scox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_
                   prod_deriv_theta_lam, prodP_X_xmax, scaleP_X, X_theta_lam,
                   xmax_col_idx, row_idx, col_idx, center, scale, n, p, f, y, d, d_idx);
     }
-    n_reject[l] = sum(safe_reject, p);
+    n_reject[l] = safe_reject.count();
+    prof_phase(PH_SWEEP);
     while (iter[l] < max_iter) {
       while (iter[l] < max_iter) {
         iter[l]++;
+        prof_sweep();
         Dev[l] = 0.0;
         
         // Calculate haz, rsk, Dev
@@ -927,7 +937,6 @@ RcppExport SEXP cdfit_cox_scox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_
         if (Dev[l] / nullDev < .01) {
           if (warn) warning("Model saturated with deviance %f; exiting...", Dev[l]);
           for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
-          Free(s); Free(w); Free(a); Free(r); Free(e1); Free(safe_reject); Free(eta); Free(haz); Free(rsk);
           return List::create(beta, center, scale, lambda, Dev,
                               iter, n_reject, Rcpp::wrap(col_idx));
         }
@@ -949,26 +958,25 @@ RcppExport SEXP cdfit_cox_scox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_
         
         // Update beta
         max_update = 0.0;
-        for (j = 0; j < p; j++) {
-          if (e1[j]) {
-            jj = col_idx[j];
-            xwr = wcrossprod_resid(xMat, r, sumWResid, row_idx, center[jj], scale[jj], w, n, jj);
-            xwx = wsqsum_bm(xMat, w, row_idx, center[jj], scale[jj], n, jj);
-            u = xwr / n + xwx * a[j] / n;
-            v = xwx / n;
-            l1 = lambda[l] * m[jj] * alpha;
-            l2 = lambda[l] * m[jj] * (1-alpha);
-            beta(j, l) = lasso(u, l1, l2, v);
+        for (int h = 0; h < e1.size(); h++) {
+          j = e1.idx[h];
+          jj = col_idx[j];
+          xwr = wcrossprod_resid(xMat, r, sumWResid, row_idx, center[jj], scale[jj], w, n, jj);
+          xwx = wsqsum_bm(xMat, w, row_idx, center[jj], scale[jj], n, jj);
+          u = xwr / n + xwx * a[j] / n;
+          v = xwx / n;
+          l1 = lambda[l] * m[jj] * alpha;
+          l2 = lambda[l] * m[jj] * (1-alpha);
+          beta(j, l) = lasso(u, l1, l2, v);
+          
+          shift = beta(j, l) - a[j];
+          if (shift !=0) {
             
-            shift = beta(j, l) - a[j];
-            if (shift !=0) {
-              
-              update = pow(beta(j, l) - a[j], 2) * v;
-              if (update > max_update) max_update = update;
-              update_resid_eta(r, eta, xMat, shift, row_idx, center[jj], scale[jj], n, jj); // update r
-              sumWResid = wsum(r, w, n); // update temp result w * r, used for computing xwr;
-              a[j] = beta(j, l); // update a
-            }
+            update = pow(beta(j, l) - a[j], 2) * v;
+            if (update > max_update) max_update = update;
+            update_resid_eta(r, eta, xMat, shift, row_idx, center[jj], scale[jj], n, jj); // update r
+            sumWResid = wsum(r, w, n); // update temp result w * r, used for computing xwr;
+            a[j] = beta(j, l); // update a
           }
         }
         // Check for convergence
@@ -979,6 +987,254 @@ RcppExport SEXP cdfit_cox_scox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_
       if (violations==0) break;
     }
   }
-  Free(s); Free(w); Free(a); Free(r); Free(e1); Free(safe_reject); Free(eta); Free(haz); Free(rsk);
   return List::create(beta, center, scale, lambda, Dev, iter, n_reject, Rcpp::wrap(col_idx));
 }
+
+// Coordinate descent for cox models with working set
+RcppExport SEXP cdfit_cox_ws(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_idx_, 
+                             SEXP lambda_, SEXP nlambda_, SEXP lam_scale_,
+                             SEXP lambda_min_, SEXP alpha_, SEXP user_, SEXP eps_, 
+                             SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
+                             SEXP ncore_, SEXP warn_, SEXP verbose_, SEXP io_) {
+  XPtr<BigMatrix> xMat(X_);
+  double *y = REAL(y_); // Failure indicator for subjects
+  double *d = REAL(d_); // Number of failure at unique failure times
+  int *d_idx = INTEGER(d_idx_); // Index of unique failure time for subjects with failure; Index of the last unique failure time if censored
+  int *row_idx = INTEGER(row_idx_);
+  double lambda_min = REAL(lambda_min_)[0];
+  double alpha = REAL(alpha_)[0];
+  int n = Rf_length(row_idx_); // number of observations used for fitting model
+  int f = Rf_length(d_); // Number of unique failure times
+  int p = xMat->ncol();
+  int L = INTEGER(nlambda_)[0];
+  int lam_scale = INTEGER(lam_scale_)[0];
+  double eps = REAL(eps_)[0];
+  int max_iter = INTEGER(max_iter_)[0];
+  double *m = REAL(multiplier_);
+  int dfmax = INTEGER(dfmax_)[0];
+  int warn = INTEGER(warn_)[0];
+  int user = INTEGER(user_)[0];
+  int verbose = INTEGER(verbose_)[0];
+  
+  NumericVector lambda(L);
+  NumericVector Dev(L);
+  IntegerVector iter(L);
+  IntegerVector n_reject(L);
+  NumericVector center(p);
+  NumericVector scale(p);
+  int p_keep = 0; // keep columns whose scale > 1e-6
+  int *p_keep_ptr = &p_keep;
+  vector<int> col_idx;
+  vector<double> z;
+  double lambda_max = 0.0;
+  double *lambda_max_ptr = &lambda_max;
+  int xmax_idx = 0;
+  int *xmax_ptr = &xmax_idx;
+  
+  // set up omp
+  int useCores = INTEGER(ncore_)[0];
+#ifdef BIGLASSO_OMP_H_
+  int haveCores = omp_get_num_procs();
+  if(useCores < 1) {
+    useCores = haveCores;
+  }
+  omp_set_dynamic(0);
+  omp_set_num_threads(useCores);
+#endif
+  
+  ProfileFit pf(n, L);
+  IoOptions io(io_);
+  
+  if (verbose) {
+    char buff1[100];
+    time_t now1 = time (0);
+    strftime (buff1, 100, "%Y-%m-%d %H:%M:%S.000", localtime (&now1));
+    Rprintf("\nPreprocessing start: %s\n", buff1);
+  }
+  
+  // standardize: get center, scale; get p_keep_ptr, col_idx; get z, lambda_max, xmax_idx;
+  standardize_and_get_residual_cox(center, scale, p_keep_ptr, col_idx, z, lambda_max_ptr, xmax_ptr, xMat, 
+                                   y, d, d_idx, row_idx, lambda_min, alpha, n, f, p);
+  p = p_keep; // set p = p_keep, only loop over columns whose scale > 1e-6
+  
+  if (verbose) {
+    char buff1[100];
+    time_t now1 = time (0);
+    strftime (buff1, 100, "%Y-%m-%d %H:%M:%S.000", localtime (&now1));
+    Rprintf("Preprocessing end: %s\n", buff1);
+    Rprintf("\n-----------------------------------------------\n");
+  }
+  
+  arma::sp_mat beta = arma::sp_mat(p, L); //beta
+  WorkBuf<double> a(p); //Beta from previous iteration
+  WorkBuf<double> w(n); //weights from diagnal of hessian matrix
+  WorkBuf<double> s(n); //y_i - yhat_i
+  WorkBuf<double> r(n); //s/w
+  WorkBuf<double> eta(n); //X\beta
+  WorkBuf<double> haz(n); //exp(eta)
+  WorkBuf<double> rsk(f); //Sum of hazard over at risk set
+  IndexSet in_ws(p); // working set indicator
+  vector<int> ws, cand(p); //working set, candidate buffer
+  vector<double> c; //X_j' s / n over working set
+  double xwr, xwx, u, v, l1, l2, shift;
+  double max_update, update, thresh; // for convergence check
+  int i, j, jj, k, t, l, violations, lstart;
+  int ws_min = 100, ws_size, nws = 0;
+  for(i = 0; i < n; i++) eta[i] = 0;
+  double sumWResid = 0.0; //sum w*r
+  
+  double nullDev = 0;
+  double satDev = 0;
+  rsk[0] = n;
+  k = 0;
+  for(i = 0; i < n; i++) {
+    if(d_idx[i] >= k) {
+      k++;
+      if(k >= f) break;
+      rsk[k] = rsk[k-1];
+    }
+    rsk[k] -= 1;
+  }
+  for (k = 0; k < f; k++) {
+    nullDev += 2 * d[k] * log(rsk[k]);
+    satDev += 2 * d[k] * log(d[k]);
+  }
+  nullDev -= satDev;
+  thresh = eps * nullDev / n;
+  
+  
+  // set up lambda
+  if (user == 0) {
+    if (lam_scale) { // set up lambda, equally spaced on log scale
+      double log_lambda_max = log(lambda_max);
+      double log_lambda_min = log(lambda_min*lambda_max);
+      
+      double delta = (log_lambda_max - log_lambda_min) / (L-1);
+      for (l = 0; l < L; l++) {
+        lambda[l] = exp(log_lambda_max - l * delta);
+      }
+    } else { // equally spaced on linear scale
+      double delta = (lambda_max - lambda_min*lambda_max) / (L-1);
+      for (l = 0; l < L; l++) {
+        lambda[l] = lambda_max - l * delta;
+      }
+    }
+    Dev[0] = nullDev;
+    lstart = 1;
+    n_reject[0] = p;
+  } else {
+    lstart = 0;
+    lambda = Rcpp::as<NumericVector>(lambda_);
+  }
+  
+  for (l = lstart; l < L; l++) {
+    prof_lambda(l);
+    if(verbose) {
+      // output time
+      char buff[100];
+      time_t now = time (0);
+      strftime (buff, 100, "%Y-%m-%d %H:%M:%S.000", localtime (&now));
+      Rprintf("Lambda %d. Now time: %s\n", l, buff);
+    }
+    
+    // Check dfmax; only the working set of the previous lambda can be nonzero
+    int nv = 0;
+    for (int h = 0; h < nws; h++) {
+      if (a[ws[h]] != 0) nv++;
+    }
+    if (l != 0 && nv > dfmax) {
+      for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
+      return List::create(beta, center, scale, lambda, Dev, 
+                          iter, n_reject, Rcpp::wrap(col_idx));
+    }
+    // working set: active features plus those closest to violating KKT
+    ws_size = 2 * nv > ws_min ? 2 * nv : ws_min;
+    nws = ws_select(ws, in_ws, cand, z, a, col_idx, m, lambda[l], alpha, ws_size, p);
+    
+    prof_phase(PH_SWEEP);
+    while (iter[l] < max_iter) {
+      while (iter[l] < max_iter) {
+        iter[l]++;
+        prof_sweep();
+        Dev[l] = 0.0;
+        
+        // Calculate haz, rsk, Dev
+        for(i = 0; i < n; i++) haz[i] = exp(eta[i]);
+        rsk[f-1] = haz[n-1];
+        k = f-1;
+        for(i = n-2; i >= 0; i--) {
+          if(d_idx[i] < k) {
+            k--;
+            rsk[k] = rsk[k+1];
+          }
+          rsk[k] += haz[i];
+        }
+        for(i = 0; i < n; i++) {
+          Dev[l] -= 2 * y[i] * (eta[i] - log(rsk[d_idx[i]])); 
+        }
+        Dev[l] -= satDev;
+        
+        // Check for saturation
+        if (Dev[l] / nullDev < .01) {
+          if (warn) warning("Model saturated with deviance %f; exiting...", Dev[l]);
+          for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
+          return List::create(beta, center, scale, lambda, Dev,
+                              iter, n_reject, Rcpp::wrap(col_idx));
+        }
+        
+        // Calculate w, s, r
+        for(i = 0; i < n; i++) {
+          w[i] = 0.0;
+          s[i] = y[i];
+          for(k = 0; k <= d_idx[i]; k++) {
+            w[i] += d[k] * (rsk[k] - haz[i]) / rsk[k] / rsk[k];
+            s[i] -= d[k] * haz[i] / rsk[k];
+          }
+          w[i] *= haz[i];
+          if(w[i] == 0) r[i] = 0.0;
+          else r[i] = s[i] / w[i];
+        }
+        
+        
+        
+        // Update beta
+        max_update = 0.0;
+        for (t = 0; t < nws; t++) {
+          j = ws[t];
+          jj = col_idx[j];
+          xwr = wcrossprod_resid(xMat, r, sumWResid, row_idx, center[jj], scale[jj], w, n, jj);
+          xwx = wsqsum_bm(xMat, w, row_idx, center[jj], scale[jj], n, jj);
+          u = xwr / n + xwx * a[j] / n;
+          v = xwx / n;
+          l1 = lambda[l] * m[jj] * alpha;
+          l2 = lambda[l] * m[jj] * (1-alpha);
+          beta(j, l) = lasso(u, l1, l2, v);
+
+          shift = beta(j, l) - a[j];
+          if (shift !=0) {
+            
+            update = pow(beta(j, l) - a[j], 2) * v;
+            if (update > max_update) max_update = update;
+            update_resid_eta(r, eta, xMat, shift, row_idx, center[jj], scale[jj], n, jj); // update r
+            sumWResid = wsum(r, w, n); // update temp result w * r, used for computing xwr;
+            a[j] = beta(j, l); // update a
+          }
+        }
+        // Check for convergence
+        if (max_update < thresh)  break;
+      }
+      // Scan for violations outside working set
+      violations = check_rest_set(in_ws, in_ws, z, xMat, row_idx, col_idx, center, scale, a, lambda[l], 0.0, alpha, s, m, n, p);
+      if (violations==0) break;
+      // grow working set, violators have the smallest margins
+      ws_size = 2 * nws > nws + violations ? 2 * nws : nws + violations;
+      nws = ws_select(ws, in_ws, cand, z, a, col_idx, m, lambda[l], alpha, ws_size, p);
+    }
+    n_reject[l] = p - nws;
+    // refresh z over the working set for selection at next lambda
+    ws_crossprod(c, ws, xMat, s, 0.0, row_idx, col_idx, center, scale, n);
+    for (t = 0; t < nws; t++) z[ws[t]] = c[t];
+  }
+  return List::create(beta, center, scale, lambda, Dev, iter, n_reject, Rcpp::wrap(col_idx));
+  
+}
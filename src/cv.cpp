@@ -0,0 +1,786 @@
+#include "utilities.h"
+
+// Native cross-validation. All folds are fit in one process on the same
+// mapped X: each fold is a FoldPath, a coordinate descent path with the
+// strong rule over its training rows, which reads X only through a
+// MatrixAccessor and keeps its state in its own buffers, so that several
+// folds can run at once on separate threads. The threads are split between
+// the folds and the column scans within each fold. Every fold keeps the
+// linear predictor of its held-out rows up to date as its coefficients
+// move, so the predictions are written straight into the n x L matrix
+// returned to R, and the held-out loss comes without another pass over X.
+//
+// Several fold assignments (repeated CV, or the inner loops of a nested CV)
+// are fit in one call. The column moments and X'y of every fold of a group
+// of repetitions come from a single pass over X that adds each row into the
+// accumulators of the folds it is held out of (FoldSums), so no fold
+// standardizes X on its own. The groups are as large as FOLD_SUMS_BUDGET
+// allows, so a small X is read once for all the repetitions and a wide one
+// once per repetition, with only that repetition's sums held.
+//
+// The same paths serve the resampling of stability selection, which fits a
+// path to each of many subsamples or bootstrap samples and keeps only how
+// often each feature is selected at each lambda.
+
+// X_j'v over the rows in rows, X_j standardized; v is given with its sum
+static inline double fold_crossprod(double *xCol, int *rows, double *v, double sumV,
+                                    double center, double scale, int n) {
+  double sum = 0.0;
+  for (int i = 0; i < n; i++) sum += xCol[rows[i]] * v[i];
+  return (sum - center * sumV) / scale;
+}
+
+// sum_i w_i * X_ij * v_i over the rows in rows, X_j standardized
+static inline double fold_wcrossprod(double *xCol, int *rows, double *v, double *w,
+                                     double sumVW, double center, double scale, int n) {
+  double sum = 0.0;
+  for (int i = 0; i < n; i++) sum += xCol[rows[i]] * v[i] * w[i];
+  return (sum - center * sumVW) / scale;
+}
+
+// sum_i w_i * X_ij^2 over the rows in rows, X_j standardized
+static inline double fold_wsqsum(double *xCol, int *rows, double *w, double sumW,
+                                 double center, double scale, int n) {
+  double sum_wx_sq = 0.0, sum_wx = 0.0, x;
+  for (int i = 0; i < n; i++) {
+    x = xCol[rows[i]];
+    sum_wx_sq += w[i] * x * x;
+    sum_wx += w[i] * x;
+  }
+  return (sum_wx_sq - 2 * center * sum_wx + center * center * sumW) / (scale * scale);
+}
+
+// held-out loss of one prediction, as loss.biglasso computes it; metric is
+// 1 for the absolute percentage error
+static inline double heldout_loss(double y, double yhat, int family, int metric) {
+  if (family) {
+    double v = yhat < 0.00001 ? 0.00001 : (yhat > 0.99999 ? 0.99999 : yhat);
+    return -2 * (y == 1 ? log(v) : log(1 - v));
+  }
+  return metric ? fabs(y - yhat) / y : pow(y - yhat, 2);
+}
+
+// bytes of fold sums held at once; see FoldSums
+#define FOLD_SUMS_BUDGET ((size_t) 256 << 20)
+
+// Sums of x, x^2 and x*y of every column over the held-out rows of each of
+// the nrep * nf folds of repetitions r0, ..., r0 + nrep - 1, from one
+// parallel pass over the columns; fold[i + r*n] is the fold (1..nf) of row i
+// in repetition r, 0 if the row is left out of that repetition. The sums over
+// the training rows of a fold are those of the other folds of its
+// repetition, added up rather than subtracted from a total so that they
+// carry no cancellation.
+class FoldSums {
+public:
+  FoldSums(MatrixAccessor<double> xAcc, int p, int *row_idx, double *y, int *fold,
+           int n, int r0, int nrep, int nf, int ncore);
+  void train(int t, vector<double> &sums) const;
+
+private:
+  int nf, T, t0;
+  vector<double> held; // column j, fold t0 + t: held[(j*T + t)*3 + 0..2]
+};
+
+FoldSums::FoldSums(MatrixAccessor<double> xAcc, int p, int *row_idx, double *y, int *fold,
+                   int n, int r0, int nrep, int nf, int ncore)
+  : nf(nf), T(nrep * nf), t0(r0 * nf), held((size_t) p * nrep * nf * 3, 0.0) {
+  int i, j, r;
+  fold += (long) r0 * n;
+#pragma omp parallel for num_threads(ncore) private(i, j, r) schedule(static)
+  for (j = 0; j < p; j++) {
+    double *xCol = xAcc[j], *h = &held[(size_t) j * T * 3], x, *hk;
+    int g;
+    for (i = 0; i < n; i++) {
+      x = xCol[row_idx[i]];
+      for (r = 0; r < nrep; r++) {
+        g = fold[i + (long) r * n];
+        if (g == 0) continue;
+        hk = h + (r * nf + g - 1) * 3;
+        hk[0] += x;
+        hk[1] += x * x;
+        hk[2] += x * y[i];
+      }
+    }
+  }
+}
+
+// sums of every column over the training rows of fold t (repetition t / nf),
+// one of the folds summed here, in sums[j*3 + 0..2]
+void FoldSums::train(int t, vector<double> &sums) const {
+  int p = held.size() / (T * 3);
+  t -= t0;
+  sums.assign((size_t) p * 3, 0.0);
+  for (int j = 0; j < p; j++) {
+    const double *h = &held[((size_t) j * T + t / nf * nf) * 3];
+    for (int g = 0; g < nf; g++, h += 3) {
+      if (g == t % nf) continue;
+      sums[j * 3] += h[0];
+      sums[j * 3 + 1] += h[1];
+      sums[j * 3 + 2] += h[2];
+    }
+  }
+}
+
+// Two levels of threads, the fits and the scans within each, with no
+// dynamic adjustment of the team sizes, for the life of the object; the
+// session's settings are restored when it goes out of scope.
+//   NestedThreads nested;
+class NestedThreads {
+public:
+  NestedThreads() {
+#if defined(_OPENMP)
+    dynamic = omp_get_dynamic();
+    levels = omp_get_max_active_levels();
+    omp_set_dynamic(0);
+    omp_set_max_active_levels(2);
+#endif
+  }
+  ~NestedThreads() {
+#if defined(_OPENMP)
+    omp_set_dynamic(dynamic);
+    omp_set_max_active_levels(levels);
+#endif
+  }
+
+private:
+  int dynamic, levels;
+  NestedThreads(const NestedThreads &);
+  NestedThreads &operator=(const NestedThreads &);
+};
+
+// Rows of one fit: the training rows, which may repeat, with their
+// responses, and the held-out rows with their responses and their positions
+// in the prediction matrix
+struct FitRows {
+  vector<int> train, test, pos;
+  vector<double> y, y_test;
+};
+
+// rows of the fold holding out the rows i with fold[i] == g, training on
+// the other rows with fold[i] > 0
+static void fold_rows(FitRows &rows, int *row_idx, double *y, int *fold, int n, int g) {
+  for (int i = 0; i < n; i++) {
+    if (fold[i] == g) {
+      rows.test.push_back(row_idx[i]);
+      rows.pos.push_back(i);
+      rows.y_test.push_back(y[i]);
+    } else if (fold[i] > 0) {
+      rows.train.push_back(row_idx[i]);
+      rows.y.push_back(y[i]);
+    }
+  }
+}
+
+// The lasso path of one fold or resample, fit one lambda at a time by
+// solve(l) in the order l = 0, 1, ..., as in cdfit_gaussian_ssr and
+// cdfit_binomial_ssr. family is 0 for gaussian and 1 for binomial. Given the path of the fit to
+// the whole data by set_parent, each lambda starts from the parent's step
+// instead of the fold's previous solution alone; see warm_start.
+class FoldPath {
+public:
+  int iter; // iterations of the last call to solve
+
+  FoldPath(MatrixAccessor<double> xAcc, int p, FitRows &rows, const double *sums,
+           int family, double alpha, double *m, double *lambda, double eps,
+           int max_iter, int dfmax, int ncore);
+  void set_parent(int *bi, int *bp, double *bx);
+  int solve(int l);
+  double predict(double *yhat, int metric);
+  void selected(vector<int> &sel);
+
+private:
+  MatrixAccessor<double> xAcc;
+  vector<int> train, test, pos; // raw row numbers; position of each test row
+  int n, p, family, max_iter, dfmax, ncore, stopped;
+  double alpha, eps, thresh, lambda_max, nullDev, a0;
+  double *m, *lambda;
+  vector<double> y, y_test, center, scale, z;
+  WorkBuf<double> a, r, w, s, eta, eta_test; // w, s and eta for binomial only
+  vector<int> col_idx;
+  IndexSet e1, e2; // ever-active set, strong set
+  // parent path: column l of the unstandardized coefficients in CSC form
+  int *bi, *bp;
+  double *bx;
+  vector<int> col_pos; // position in col_idx of each column of X, or -1
+  vector<double> delta;
+
+  void warm_start(int l);
+  void move(int j, double shift);
+  int weights();
+  double sweep(int l);
+  int kkt_scan(int l, int strong);
+
+  FoldPath(const FoldPath &);
+  FoldPath &operator=(const FoldPath &);
+};
+
+// standardize the columns over the training rows and set up the residuals;
+// the rows are taken over from rows, whose responses are 0/1 for binomial.
+// The buffers updated along the path come from the workspace, so the folds
+// and resamples fit one after another reuse the same memory.
+// sums[j*3 + 0..2] holds the sums of x, x^2 and x*y of column j over the
+// training rows; if sums is NULL they are computed here.
+FoldPath::FoldPath(MatrixAccessor<double> xAcc, int p, FitRows &rows, const double *sums,
+                   int family, double alpha, double *m, double *lambda, double eps,
+                   int max_iter, int dfmax, int ncore)
+  : iter(0), xAcc(xAcc), p(p), family(family), max_iter(max_iter), dfmax(dfmax),
+    ncore(ncore), stopped(0), alpha(alpha), eps(eps), lambda_max(0.0), nullDev(0.0),
+    a0(0.0), m(m), lambda(lambda), center(p), scale(p), a(p), r(rows.train.size()),
+    w(family ? rows.train.size() : 0), s(family ? rows.train.size() : 0),
+    eta(family ? rows.train.size() : 0), eta_test(rows.test.size()), e1(p), e2(p),
+    bi(NULL), bp(NULL), bx(NULL) {
+  int i, j;
+  train.swap(rows.train);
+  test.swap(rows.test);
+  pos.swap(rows.pos);
+  y.swap(rows.y);
+  y_test.swap(rows.y_test);
+  n = train.size();
+
+  double ybar = 0.0, sum_y = 0.0, zmax = 0.0;
+  for (i = 0; i < n; i++) ybar += y[i];
+  ybar /= n;
+  if (family == 0) {
+    // center y; the intercept stays at ybar
+    for (i = 0; i < n; i++) y[i] -= ybar;
+  }
+  for (i = 0; i < n; i++) sum_y += y[i];
+
+  vector<double> zj(p);
+#pragma omp parallel for num_threads(ncore) private(i, j) schedule(static)
+  for (j = 0; j < p; j++) {
+    double sx = 0.0, sxx = 0.0, sxy = 0.0;
+    if (sums != NULL) {
+      sx = sums[j * 3];
+      sxx = sums[j * 3 + 1];
+      sxy = sums[j * 3 + 2] - (family == 0 ? ybar * sx : 0.0); // y is centered
+    } else {
+      double *xCol = xAcc[j], x;
+      for (i = 0; i < n; i++) {
+        x = xCol[train[i]];
+        sx += x;
+        sxx += x * x;
+        sxy += x * y[i];
+      }
+    }
+    center[j] = sx / n;
+    scale[j] = sqrt(sxx / n - center[j] * center[j]);
+    zj[j] = (sxy - center[j] * sum_y) / (scale[j] * n);
+  }
+  for (j = 0; j < p; j++) {
+    if (scale[j] > 1e-6) {
+      col_idx.push_back(j);
+      z.push_back(zj[j]);
+      if (fabs(zj[j]) > zmax) zmax = fabs(zj[j]);
+    }
+  }
+  lambda_max = zmax / alpha;
+  this->p = col_idx.size();
+
+  if (family == 0) {
+    a0 = ybar;
+    double rss = 0.0;
+    for (i = 0; i < n; i++) {
+      r[i] = y[i];
+      rss += r[i] * r[i];
+    }
+    thresh = eps * rss / n;
+  } else {
+    a0 = log(ybar / (1 - ybar));
+    for (i = 0; i < n; i++) {
+      eta[i] = a0;
+      nullDev = nullDev - y[i] * log(ybar) - (1 - y[i]) * log(1 - ybar);
+      s[i] = y[i] - ybar;
+    }
+    thresh = eps * nullDev / n;
+  }
+  for (i = 0; i < (int) test.size(); i++) eta_test[i] = a0;
+}
+
+void FoldPath::set_parent(int *bi, int *bp, double *bx) {
+  this->bi = bi;
+  this->bp = bp;
+  this->bx = bx;
+  col_pos.assign(center.size(), -1);
+  for (int j = 0; j < p; j++) col_pos[col_idx[j]] = j;
+  delta.assign(p, 0.0);
+}
+
+// Move the coefficients of the ever-active set by the step of the parent
+// path from lambda[l-1] to lambda[l], on the scale of the fold's
+// standardization, and add the parent's active set at lambda[l] to the strong
+// set. The fold and the whole data share most of their rows, so this start
+// is close to the fold's solution and the sweeps and the strong set KKT
+// checks find little to do. Features new to the fold are left to the KKT
+// check, so that the ever-active set does not collect the parent's.
+void FoldPath::warm_start(int l) {
+  int j, jj, k;
+  vector<int> moved;
+  for (int c = l - 1; c <= l; c++) {
+    if (c < 0) continue;
+    for (k = bp[c]; k < bp[c + 1]; k++) {
+      jj = bi[k];
+      j = col_pos[jj];
+      if (j < 0) continue;
+      if (c == l) e2.add(j);
+      if (!e1.has(j)) continue;
+      if (delta[j] == 0) moved.push_back(j);
+      delta[j] += (c == l ? 1 : -1) * bx[k] * scale[jj];
+    }
+  }
+  for (k = 0; k < (int) moved.size(); k++) {
+    j = moved[k];
+    double shift = delta[j];
+    delta[j] = 0;
+    if (shift != 0) move(j, shift);
+  }
+}
+
+// add shift to the coefficient of feature j, updating the residuals (and eta
+// for binomial) of the training rows and the linear predictor of the
+// held-out rows from the same read of the column
+void FoldPath::move(int j, double shift) {
+  int i, jj = col_idx[j], nt = test.size();
+  double *xCol = xAcc[jj], si, c = center[jj], sc = scale[jj];
+  for (i = 0; i < n; i++) {
+    si = shift * (xCol[train[i]] - c) / sc;
+    r[i] -= si;
+    if (family) eta[i] += si;
+  }
+  for (i = 0; i < nt; i++) eta_test[i] += shift * (xCol[test[i]] - c) / sc;
+  a[j] += shift;
+}
+
+// IRLS weights and working residuals at the current eta; returns 0 if the
+// model is saturated
+int FoldPath::weights() {
+  double pi, dev = 0.0;
+  for (int i = 0; i < n; i++) {
+    if (eta[i] > 10) {
+      pi = 1;
+      w[i] = .0001;
+    } else if (eta[i] < -10) {
+      pi = 0;
+      w[i] = .0001;
+    } else {
+      pi = exp(eta[i]) / (1 + exp(eta[i]));
+      w[i] = pi * (1 - pi);
+    }
+    s[i] = y[i] - pi;
+    r[i] = s[i] / w[i];
+    dev = dev - (y[i] == 1 ? log(pi) : log(1 - pi));
+  }
+  return dev / nullDev >= .01;
+}
+
+// one sweep over the ever-active set, after the intercept for binomial;
+// returns the largest change of a coefficient, scaled as in the full fit
+double FoldPath::sweep(int l) {
+  int i, j, jj, k;
+  double u, v, l1, l2, b, shift, update, max_update = 0.0;
+  double sumR = 0.0, sumW = 0.0;
+  if (family) {
+    double xwr = 0.0;
+    for (i = 0; i < n; i++) {
+      xwr += w[i] * r[i];
+      sumW += w[i];
+    }
+    shift = xwr / sumW;
+    if (shift != 0) {
+      a0 += shift;
+      for (i = 0; i < n; i++) {
+        r[i] -= shift;
+        eta[i] += shift;
+      }
+      for (i = 0; i < (int) test.size(); i++) eta_test[i] += shift;
+    }
+    sumR = wsum(&r[0], &w[0], n);
+  } else {
+    sumR = sum(&r[0], n);
+  }
+
+  for (k = 0; k < e1.size(); k++) {
+    j = e1.idx[k];
+    jj = col_idx[j];
+    double *xCol = xAcc[jj];
+    if (family) {
+      v = fold_wsqsum(xCol, &train[0], &w[0], sumW, center[jj], scale[jj], n) / n;
+      u = fold_wcrossprod(xCol, &train[0], &r[0], &w[0], sumR, center[jj], scale[jj], n) / n + v * a[j];
+    } else {
+      v = 1;
+      u = z[j] = fold_crossprod(xCol, &train[0], &r[0], sumR, center[jj], scale[jj], n) / n + a[j];
+    }
+    l1 = lambda[l] * m[jj] * alpha;
+    l2 = lambda[l] * m[jj] * (1 - alpha);
+    b = lasso(u, l1, l2, v);
+    shift = b - a[j];
+    if (shift != 0) {
+      update = shift * shift * v;
+      if (update > max_update) max_update = update;
+      move(j, shift);
+      sumR = family ? wsum(&r[0], &w[0], n) : sum(&r[0], n);
+    }
+  }
+  return max_update;
+}
+
+// KKT check over the strong set outside e1 (strong = 1), adding violations
+// to e1, or over the features outside the strong set, adding violations to
+// e1 and e2, as check_strong_set and check_rest_set do
+int FoldPath::kkt_scan(int l, int strong) {
+  double *v = family ? &s[0] : &r[0];
+  double sumV = sum(v, n);
+  vector<int> cand;
+  int j, k, violations = 0;
+  for (j = 0; j < p; j++) {
+    if (strong ? e2.has(j) && !e1.has(j) : !e2.has(j)) cand.push_back(j);
+  }
+  int nc = cand.size();
+#pragma omp parallel for num_threads(ncore) private(j, k) schedule(static)
+  for (k = 0; k < nc; k++) {
+    j = cand[k];
+    int jj = col_idx[j];
+    z[j] = fold_crossprod(xAcc[jj], &train[0], v, sumV, center[jj], scale[jj], n) / n;
+  }
+  for (k = 0; k < nc; k++) {
+    j = cand[k];
+    if (fabs(z[j] - a[j] * lambda[l] * m[col_idx[j]] * (1 - alpha)) >
+        lambda[l] * m[col_idx[j]] * alpha) {
+      e1.add(j);
+      if (!strong) e2.add(j);
+      violations++;
+    }
+  }
+  return violations;
+}
+
+// fit at lambda[l], starting from the fit at lambda[l-1]; returns 0 if
+// the path has stopped, because more than dfmax features are nonzero or the
+// binomial model is saturated
+int FoldPath::solve(int l) {
+  if (stopped) return 0;
+  int h, j, nv = 0;
+  if (l != 0) {
+    for (h = 0; h < e1.size(); h++) {
+      if (a[e1.idx[h]] != 0) nv++;
+    }
+    if (nv > dfmax) {
+      stopped = 1;
+      return 0;
+    }
+  }
+  // strong set
+  double cutoff = 2 * lambda[l] - (l != 0 ? lambda[l-1] : lambda_max);
+  e2.clear();
+  for (j = 0; j < p; j++) {
+    if (fabs(z[j]) > (cutoff * alpha * m[col_idx[j]])) e2.add(j);
+  }
+  if (bp != NULL) warm_start(l);
+
+  iter = 0;
+  while (iter < max_iter) {
+    while (iter < max_iter) {
+      while (iter < max_iter) {
+        iter++;
+        if (family && !weights()) {
+          stopped = 1;
+          return 0;
+        }
+        if (sweep(l) < thresh) break;
+      }
+      if (kkt_scan(l, 1) == 0) break;
+    }
+    if (kkt_scan(l, 0) == 0) break;
+  }
+  return 1;
+}
+
+// linear predictor (gaussian) or probability (binomial) for the held-out
+// rows, written to yhat[pos[i]] for the i-th of them; returns the sum of
+// their losses
+double FoldPath::predict(double *yhat, int metric) {
+  int i, nt = test.size();
+  double e = 0.0, v;
+  for (i = 0; i < nt; i++) {
+    v = family ? exp(eta_test[i]) / (1 + exp(eta_test[i])) : eta_test[i];
+    yhat[pos[i]] = v;
+    e += heldout_loss(y_test[i], v, family, metric);
+  }
+  return e;
+}
+
+// append the columns of X with a nonzero coefficient to sel
+void FoldPath::selected(vector<int> &sel) {
+  for (int k = 0; k < e1.size(); k++) {
+    int j = e1.idx[k];
+    if (a[j] != 0) sel.push_back(col_idx[j]);
+  }
+}
+
+// n x (L * nrep) predictions, the column l + r*L holding those of repetition
+// r for each row from the fit without its fold, NA where that fit stopped
+// early or the row is left out of the repetition; and the (nfolds * nrep) x L
+// iteration counts. fold_ is the n x nrep matrix of fold assignments, with 0
+// for a row left out. If beta_p_ is not empty, beta_i_, beta_p_ and beta_x_
+// hold the unstandardized coefficients of the fit to the whole data (without
+// intercept) as a CSC matrix, from which every fold is warm-started.
+//
+// The fold fits are handed out one at a time to the threads that become
+// free, each fit living only while its thread runs it. With stop_rise > 0
+// all the folds instead advance together, one lambda at a time, and the path
+// stops once the CV error over all the repetitions has risen stop_rise times
+// in a row, or once a fold has stopped; the lambdas after that are left NA.
+// Returns NULL if a fold could not allocate its buffers.
+RcppExport SEXP cvfit_native(SEXP X_, SEXP y_, SEXP row_idx_, SEXP fold_, SEXP nfolds_,
+                             SEXP family_, SEXP lambda_, SEXP alpha_, SEXP eps_,
+                             SEXP max_iter_, SEXP multiplier_, SEXP dfmax_,
+                             SEXP beta_i_, SEXP beta_p_, SEXP beta_x_,
+                             SEXP metric_, SEXP stop_rise_, SEXP ncore_) {
+  XPtr<BigMatrix> xMat(X_);
+  MatrixAccessor<double> xAcc(*xMat);
+  double *y = REAL(y_);
+  int *row_idx = INTEGER(row_idx_);
+  int *fold = INTEGER(fold_);
+  int nf = INTEGER(nfolds_)[0];
+  int family = INTEGER(family_)[0];
+  double *lambda = REAL(lambda_);
+  double alpha = REAL(alpha_)[0];
+  double eps = REAL(eps_)[0];
+  int max_iter = INTEGER(max_iter_)[0];
+  double *m = REAL(multiplier_);
+  int dfmax = INTEGER(dfmax_)[0];
+  int warm = Rf_length(beta_p_) > 0;
+  int *bi = INTEGER(beta_i_), *bp = INTEGER(beta_p_);
+  double *bx = REAL(beta_x_);
+  int metric = INTEGER(metric_)[0];
+  int stop_rise = INTEGER(stop_rise_)[0];
+  int n = Rf_length(row_idx_);
+  int nrep = Rf_length(fold_) / n;
+  int T = nrep * nf;
+  int p = xMat->ncol();
+  int L = Rf_length(lambda_);
+  int i, t, l, r0, nr;
+
+  // repetitions whose fold sums are held at once
+  size_t rep_bytes = (size_t) p * nf * 3 * sizeof(double);
+  int rg = FOLD_SUMS_BUDGET / rep_bytes;
+  if (rg < 1) rg = 1;
+  if (rg > nrep) rg = nrep;
+
+  // folds run on outer threads, each with inner threads for its scans; the
+  // folds of a group of repetitions are fit at once, or all of them with
+  // stop_rise
+  int useCores = INTEGER(ncore_)[0];
+  if (useCores < 1) useCores = omp_get_num_procs();
+  int nfit = stop_rise <= 0 ? rg * nf : T;
+  int outer = nfit < useCores ? nfit : useCores;
+  int inner = useCores / outer > 1 ? useCores / outer : 1;
+  NestedThreads nested;
+
+  // folds with both training and held-out rows
+  vector<int> ntest(T, 0), nrows(nrep, 0), ok_fold(T);
+  for (int r = 0; r < nrep; r++) {
+    for (i = 0; i < n; i++) {
+      int g = fold[i + (long) r * n];
+      if (g == 0) continue;
+      ntest[r * nf + g - 1]++;
+      nrows[r]++;
+    }
+  }
+  long nheld = 0;
+  for (t = 0; t < T; t++) {
+    ok_fold[t] = ntest[t] > 0 && ntest[t] < nrows[t / nf];
+    if (ok_fold[t]) nheld += ntest[t];
+  }
+
+  NumericMatrix yhat(n, L * nrep);
+  IntegerMatrix iter(T, L);
+  std::fill(yhat.begin(), yhat.end(), NA_REAL);
+  std::fill(iter.begin(), iter.end(), NA_INTEGER);
+  double *Y = yhat.begin();
+  int *it = iter.begin();
+  // set by a thread whose fold could not get its memory; the fold threads
+  // must not raise the R error themselves, so the call returns NULL instead
+  int failed = 0;
+
+  if (stop_rise <= 0) {
+    // each fold runs down its own path
+    for (r0 = 0; r0 < nrep && !failed; r0 += rg) {
+      nr = nrep - r0 < rg ? nrep - r0 : rg;
+      FoldSums sums(xAcc, p, row_idx, y, fold, n, r0, nr, nf, useCores);
+#pragma omp parallel for num_threads(outer) private(t, l) reduction(|:failed) schedule(dynamic, 1)
+      for (t = r0 * nf; t < (r0 + nr) * nf; t++) {
+        if (!ok_fold[t] || failed) continue;
+        try {
+          FitRows rows;
+          vector<double> ts;
+          fold_rows(rows, row_idx, y, fold + (long) (t / nf) * n, n, t % nf + 1);
+          sums.train(t, ts);
+          FoldPath fit(xAcc, p, rows, &ts[0], family, alpha, m, lambda, eps, max_iter,
+                       dfmax, inner);
+          vector<double>().swap(ts);
+          if (warm) fit.set_parent(bi, bp, bx);
+          for (l = 0; l < L; l++) {
+            if (!fit.solve(l)) break;
+            it[t + (long) l * T] = fit.iter;
+            fit.predict(Y + ((long) (t / nf) * L + l) * n, metric);
+          }
+        } catch (std::bad_alloc &) {
+          failed = 1;
+        }
+      }
+    }
+  } else {
+    vector<FoldPath*> fits(T, (FoldPath*) NULL);
+    for (r0 = 0; r0 < nrep && !failed; r0 += rg) {
+      nr = nrep - r0 < rg ? nrep - r0 : rg;
+      FoldSums sums(xAcc, p, row_idx, y, fold, n, r0, nr, nf, useCores);
+#pragma omp parallel for num_threads(outer) private(t) reduction(|:failed) schedule(dynamic)
+      for (t = r0 * nf; t < (r0 + nr) * nf; t++) {
+        if (!ok_fold[t] || failed) continue;
+        try {
+          FitRows rows;
+          vector<double> ts;
+          fold_rows(rows, row_idx, y, fold + (long) (t / nf) * n, n, t % nf + 1);
+          sums.train(t, ts);
+          fits[t] = new FoldPath(xAcc, p, rows, &ts[0], family, alpha, m, lambda, eps,
+                                 max_iter, dfmax, inner);
+          if (warm) fits[t]->set_parent(bi, bp, bx);
+        } catch (std::bad_alloc &) {
+          failed = 1;
+        }
+      }
+    }
+    // the fold losses are added in fold order, so that the stopping point
+    // does not depend on which thread finished first
+    vector<double> fold_loss(T);
+    double cve, cve_prev = 0.0;
+    int rises = 0, ok;
+    for (l = 0; l < L && !failed; l++) {
+      ok = 1;
+#pragma omp parallel for num_threads(outer) private(t) reduction(&&:ok) reduction(|:failed) schedule(dynamic)
+      for (t = 0; t < T; t++) {
+        fold_loss[t] = 0.0;
+        if (fits[t] == NULL) continue;
+        try {
+          if (fits[t]->solve(l)) {
+            it[t + (long) l * T] = fits[t]->iter;
+            fold_loss[t] = fits[t]->predict(Y + ((long) (t / nf) * L + l) * n, metric);
+          } else {
+            ok = 0;
+          }
+        } catch (std::bad_alloc &) {
+          failed = 1;
+        }
+      }
+      if (!ok || failed) break;
+      cve = 0.0;
+      for (t = 0; t < T; t++) cve += fold_loss[t];
+      cve /= nheld;
+      if (l > 0 && cve > cve_prev) {
+        if (++rises >= stop_rise) break;
+      } else {
+        rises = 0;
+      }
+      cve_prev = cve;
+    }
+    for (t = 0; t < T; t++) delete fits[t];
+  }
+  if (failed) return R_NilValue;
+
+  return List::create(yhat, iter);
+}
+
+// Selection counts of the paths fit to nb resamples of the rows in row_idx:
+// column b of the m x nb matrix idx_ holds the positions (0-based, possibly
+// repeated) in row_idx of the rows of resample b. The resamples are handed
+// out one at a time to the threads that become free, each fit standardizing
+// over its own rows and living only while its thread runs it; only the
+// columns selected at each lambda are kept. Returns the p x L counts as a
+// CSC matrix (row indices, column pointers, counts) and, for each lambda,
+// the number of resamples whose path reached it. beta_i_, beta_p_ and
+// beta_x_ are as in cvfit_native. Returns NULL if a fit could not allocate
+// its buffers.
+RcppExport SEXP stability_native(SEXP X_, SEXP y_, SEXP row_idx_, SEXP idx_,
+                                 SEXP family_, SEXP lambda_, SEXP alpha_, SEXP eps_,
+                                 SEXP max_iter_, SEXP multiplier_, SEXP dfmax_,
+                                 SEXP beta_i_, SEXP beta_p_, SEXP beta_x_, SEXP ncore_) {
+  XPtr<BigMatrix> xMat(X_);
+  MatrixAccessor<double> xAcc(*xMat);
+  double *y = REAL(y_);
+  int *row_idx = INTEGER(row_idx_);
+  int *idx = INTEGER(idx_);
+  int family = INTEGER(family_)[0];
+  double *lambda = REAL(lambda_);
+  double alpha = REAL(alpha_)[0];
+  double eps = REAL(eps_)[0];
+  int max_iter = INTEGER(max_iter_)[0];
+  double *m = REAL(multiplier_);
+  int dfmax = INTEGER(dfmax_)[0];
+  int warm = Rf_length(beta_p_) > 0;
+  int *bi = INTEGER(beta_i_), *bp = INTEGER(beta_p_);
+  double *bx = REAL(beta_x_);
+  int ms = Rf_nrows(idx_);
+  int nb = Rf_ncols(idx_);
+  int p = xMat->ncol();
+  int L = Rf_length(lambda_);
+  int b, k, l;
+
+  int useCores = INTEGER(ncore_)[0];
+  if (useCores < 1) useCores = omp_get_num_procs();
+  int outer = nb < useCores ? nb : useCores;
+  int inner = useCores / outer > 1 ? useCores / outer : 1;
+  NestedThreads nested;
+
+  // columns selected by resample b at lambda l, in sel[b] after the
+  // selections of the earlier lambdas; len[b][l] is where lambda l ends
+  vector<vector<int> > sel(nb), len(nb);
+  int failed = 0; // as in cvfit_native
+#pragma omp parallel for num_threads(outer) private(b, k, l) reduction(|:failed) schedule(dynamic, 1)
+  for (b = 0; b < nb; b++) {
+    if (failed) continue;
+    try {
+      FitRows rows;
+      int *ib = idx + (long) b * ms;
+      for (k = 0; k < ms; k++) {
+        rows.train.push_back(row_idx[ib[k]]);
+        rows.y.push_back(y[ib[k]]);
+      }
+      FoldPath fit(xAcc, p, rows, NULL, family, alpha, m, lambda, eps, max_iter,
+                   dfmax, inner);
+      if (warm) fit.set_parent(bi, bp, bx);
+      for (l = 0; l < L; l++) {
+        if (!fit.solve(l)) break;
+        fit.selected(sel[b]);
+        len[b].push_back(sel[b].size());
+      }
+    } catch (std::bad_alloc &) {
+      failed = 1;
+    }
+  }
+  if (failed) return R_NilValue;
+
+  // add up the selections, one lambda at a time
+  IntegerVector nfit(L), cp(L + 1);
+  vector<int> count(p, 0), ci, cx;
+  for (l = 0; l < L; l++) {
+    vector<int> touched;
+    for (b = 0; b < nb; b++) {
+      if (l >= (int) len[b].size()) continue;
+      nfit[l]++;
+      for (k = l ? len[b][l - 1] : 0; k < len[b][l]; k++) {
+        if (count[sel[b][k]]++ == 0) touched.push_back(sel[b][k]);
+      }
+    }
+    std::sort(touched.begin(), touched.end());
+    for (k = 0; k < (int) touched.size(); k++) {
+      ci.push_back(touched[k]);
+      cx.push_back(count[touched[k]]);
+      count[touched[k]] = 0;
+    }
+    cp[l + 1] = ci.size();
+  }
+
+  return List::create(IntegerVector(ci.begin(), ci.end()), cp,
+                      IntegerVector(cx.begin(), cx.end()), nfit);
+}
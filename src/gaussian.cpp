@@ -1,15 +1,11 @@
 #include "utilities.h"
 
 // apply EDPP 
-void edpp_screen(int *discard_beta, int n, int p, double rhs2, double *Xtr, double *lhs2,
+void edpp_screen(BitSet &discard_beta, int n, int p, double rhs2, double *Xtr, double *lhs2,
                  double c, double c1, double *m, double alpha, vector<int> &col_idx) {
   int j;
   for(j = 0; j < p; j ++) {
-    if(fabs(c1 * Xtr[j] + c / 2 * lhs2[j]) < n * alpha * m[col_idx[j]] - c / 2 * rhs2) {
-      discard_beta[j] = 1;
-    } else {
-      discard_beta[j] = 0;
-    }
+    discard_beta.assign(j, fabs(c1 * Xtr[j] + c / 2 * lhs2[j]) < n * alpha * m[col_idx[j]] - c / 2 * rhs2);
   }
 }
 
@@ -18,21 +14,29 @@ void edpp_update(XPtr<BigMatrix> xpMat, double *r, double sumResid, double *lhs2
                  double *Xtr, double *yhat, double ytyhat, double yhat_norm2,
                  int *row_idx, vector<int>& col_idx, NumericVector& center, 
                  NumericVector& scale, int n, int p) {
-  MatrixAccessor<double> xAcc(*xpMat);
-  double *xCol;
-  int j, jj;
-  double sum;
-#pragma omp parallel for schedule(static) private(j, jj, xCol, sum)
-  for(j = 0; j < p; j++){
-    jj = col_idx[j];
-    xCol = xAcc[jj];
-    sum = 0.0;
-    for(int i = 0; i < n; i++) {
-      sum = sum + xCol[row_idx[i]] * r[i];
-    }
-    sum = (sum - center[jj] * sumResid) / scale[jj];
-    Xtr[j] = sum;
-    lhs2[j] = Xty[j] - ytyhat / yhat_norm2 * (Xty[j] - sum);
+  ProfilePhase ph(PH_SAFE);
+  ColumnStream cs(xpMat, col_idx, NULL, p);
+  NodeCopies rc(r, n);
+  prof_reads(p);
+  while (cs.next()) {
+#pragma omp parallel OMP_SPREAD
+    {
+      double *rl = rc.get(), *xCol, sum;
+      int j, jj, k, lo, hi;
+      cs.range(omp_get_thread_num(), omp_get_num_threads(), &lo, &hi);
+      for(k = lo; k < hi; k++){
+        j = cs.col(k);
+        jj = col_idx[j];
+        xCol = cs.data(k);
+        sum = 0.0;
+        for(int i = 0; i < n; i++) {
+          sum = sum + xCol[row_idx[i]] * rl[i];
+        }
+        sum = (sum - center[jj] * sumResid) / scale[jj];
+        Xtr[j] = sum;
+        lhs2[j] = Xty[j] - ytyhat / yhat_norm2 * (Xty[j] - sum);
+      }
+    }
   }
 }
 
@@ -41,26 +45,17 @@ void bedpp_init(vector<double>& sign_lammax_xtxmax,
                 XPtr<BigMatrix> xMat, int xmax_idx, double *y, double lambda_max, 
                 int *row_idx, vector<int>& col_idx, NumericVector& center, 
                 NumericVector& scale, int n, int p) {
-  MatrixAccessor<double> xAcc(*xMat);
-  double *xCol, *xCol_max;
-  double sum_xjxmax, sum_xmaxTy, sign_xmaxTy;
-  xCol_max = xAcc[xmax_idx];
-  int j, jj;
+  ProfilePhase ph(PH_SAFE);
+  double sum_xmaxTy, sign_xmaxTy;
+  int j;
   // sign of xmaxTy
   sum_xmaxTy = crossprod_bm(xMat, y, row_idx, center[xmax_idx], scale[xmax_idx], n, xmax_idx);
   sign_xmaxTy = sign(sum_xmaxTy);
   
-#pragma omp parallel for private(j, sum_xjxmax) schedule(static) 
+  crossprod_xmax(&sign_lammax_xtxmax[0], xMat, xmax_idx, row_idx, col_idx, center, scale, n, p);
   for (j = 0; j < p; j++) { // p = p_keep
-    jj = col_idx[j]; // index in the raw XMat, not in col_idx;
-    if (jj != xmax_idx) {
-      xCol = xAcc[jj];
-      sum_xjxmax = 0.0;
-      for (int i = 0; i < n; i++) {
-        sum_xjxmax = sum_xjxmax + xCol[row_idx[i]] * xCol_max[row_idx[i]];
-      }
-      sign_lammax_xtxmax[j] = sign_xmaxTy * lambda_max * (sum_xjxmax - n * center[jj] * 
-        center[xmax_idx]) / (scale[jj] * scale[xmax_idx]);;
+    if (col_idx[j] != xmax_idx) {
+      sign_lammax_xtxmax[j] = sign_xmaxTy * lambda_max * sign_lammax_xtxmax[j];
     } else {
       sign_lammax_xtxmax[j] = sign_xmaxTy * lambda_max * n;
     }
@@ -68,22 +63,21 @@ void bedpp_init(vector<double>& sign_lammax_xtxmax,
 }
 
 // Basic (non-sequential) EDPP test
-void bedpp_screen(int *bedpp_reject, const vector<double>& sign_lammax_xtxmax,
+void bedpp_screen(BitSet &bedpp_reject, const vector<double>& sign_lammax_xtxmax,
                   const vector<double>& XTy, double ynorm_sq, int *row_idx, 
                   vector<int>& col_idx, double lambda, double lambda_max, 
                   double alpha, int n, int p) {
   double LHS = 0.0;
   double RHS = 2 * n * alpha * lambda * lambda_max - (lambda_max - lambda) * 
     sqrt(n * ynorm_sq * (1 + lambda * (1 - alpha)) - pow(n * alpha * lambda_max, 2));
-  int j;
+  int b, j, nw = bedpp_reject.nwords();
   
-#pragma omp parallel for private(j, LHS) schedule(static)
-  for (j = 0; j < p; j++) { // p = p_keep
-    LHS = (lambda + lambda_max) * XTy[j] - (lambda_max - lambda) * alpha * sign_lammax_xtxmax[j] / (1 + lambda * (1 - alpha));
-    if (fabs(LHS) < RHS) {
-      bedpp_reject[j] = 1;
-    } else {
-      bedpp_reject[j] = 0;
+  // each thread owns whole 64-bit words of the mask
+#pragma omp parallel for private(b, j, LHS) schedule(static)
+  for (b = 0; b < nw; b++) {
+    for (j = b * 64; j < p && j < (b + 1) * 64; j++) { // p = p_keep
+      LHS = (lambda + lambda_max) * XTy[j] - (lambda_max - lambda) * alpha * sign_lammax_xtxmax[j] / (1 + lambda * (1 - alpha));
+      bedpp_reject.assign(j, fabs(LHS) < RHS);
     }
   }
 }
@@ -94,7 +88,8 @@ RcppExport SEXP cdfit_gaussian_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
                                    SEXP lam_scale_, SEXP lambda_min_, 
                                    SEXP alpha_, SEXP user_, SEXP eps_, 
                                    SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
-                                   SEXP ncore_, SEXP verbose_) {
+                                   SEXP ncore_, SEXP accel_, SEXP gap_stop_, 
+                                   SEXP order_, SEXP verbose_, SEXP io_) {
   XPtr<BigMatrix> xMat(X_);
   double *y = REAL(y_);
   int *row_idx = INTEGER(row_idx_);
@@ -111,6 +106,9 @@ RcppExport SEXP cdfit_gaussian_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
   int max_iter = INTEGER(max_iter_)[0];
   double *m = REAL(multiplier_);
   int dfmax = INTEGER(dfmax_)[0];
+  int accel = INTEGER(accel_)[0];
+  int gap_stop = INTEGER(gap_stop_)[0];
+  int order = INTEGER(order_)[0]; // 0: cyclic, 1: random, 2: greedy
   
   NumericVector lambda(L);
   NumericVector center(p);
@@ -135,6 +133,9 @@ RcppExport SEXP cdfit_gaussian_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
   omp_set_num_threads(useCores);
 #endif
   
+  ProfileFit pf(n, L);
+  IoOptions io(io_);
+  
   if (verbose) {
     char buff1[100];
     time_t now1 = time (0);
@@ -158,18 +159,37 @@ RcppExport SEXP cdfit_gaussian_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
   
   // Objects to be returned to R
   arma::sp_mat beta = arma::sp_mat(p, L); // beta
-  double *a = Calloc(p, double); //Beta from previous iteration
+  WorkBuf<double> a(p); //Beta from previous iteration
   NumericVector loss(L);
   IntegerVector iter(L);
   IntegerVector n_reject(L);
+  IntegerVector n_accel(L); // accepted extrapolations
+  NumericVector gap(L); // duality gap at each lambda
   
   double l1, l2, cutoff, shift;
   double max_update, update, thresh; // for convergence check
+  double ws_thresh, ws_gap, ws_prev; // working-set gap, tightened when the full gap fails
   int i, j, jj, l, violations, lstart;
-  int *e1 = Calloc(p, int); // ever active set
-  int *e2 = Calloc(p, int); // strong set
-  double *r = Calloc(n, double);
+  IndexSet e1(p); // ever active set
+  IndexSet e2(p); // strong set
+  WorkBuf<double> r(n);
   for (i = 0; i < n; i++) r[i] = y[i];
+  // compact list of ever-active features, visited in the order given by ord
+  int n_act = 0, t, k;
+  vector<int> act, ord;
+  vector<double> viol; // KKT residual of each coordinate at its last visit
+  if (order == 1) GetRNGstate();
+  // Anderson extrapolation over the ever-active set, every K sweeps
+  int K = 5, n_hist = 0;
+  vector<double> hist, extr;
+  WorkBuf<double> r_extr(accel ? n : 0);
+  // duality gap: gradients over ever-active set and over all features
+  vector<int> all;
+  vector<double> c_act, c_all;
+  if (gap_stop) {
+    for (j = 0; j < p; j++) all.push_back(j);
+    c_all.resize(p);
+  }
   double sumResid = sum(r, n);
   loss[0] = gLoss(r,n);
   thresh = eps * loss[0] / n;
@@ -199,6 +219,7 @@ RcppExport SEXP cdfit_gaussian_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
   
   // Path
   for (l = lstart; l < L; l++) {
+    prof_lambda(l);
     if(verbose) {
       // output time
       char buff[100];
@@ -209,67 +230,120 @@ RcppExport SEXP cdfit_gaussian_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
     if (l != 0) {
       // Check dfmax
       int nv = 0;
-      for (j = 0; j < p; j++) {
-        if (a[j] != 0) nv++;
+      for (int h = 0; h < e1.size(); h++) {
+        if (a[e1.idx[h]] != 0) nv++;
       }
       if (nv > dfmax) {
         for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
-        Free(a); Free(r); Free(e1); Free(e2);
-        return List::create(beta, center, scale, lambda, loss, iter, n_reject, Rcpp::wrap(col_idx));
+        if (order == 1) PutRNGstate();
+        return List::create(beta, center, scale, lambda, loss, iter, n_reject, Rcpp::wrap(col_idx), n_accel, gap);
       }
       // strong set
       cutoff = 2 * lambda[l] - lambda[l-1];
+      e2.clear();
       for (j = 0; j < p; j++) {
         if (fabs(z[j]) > (cutoff * alpha * m[col_idx[j]])) {
-          e2[j] = 1;
-        } else {
-          e2[j] = 0;
+          e2.add(j);
         }
       } 
     } else {
       // strong set
       cutoff = 2*lambda[l] - lambda_max;
+      e2.clear();
       for (j = 0; j < p; j++) {
         if (fabs(z[j]) > (cutoff * alpha * m[col_idx[j]])) {
-          e2[j] = 1;
-        } else {
-          e2[j] = 0;
+          e2.add(j);
         }
       }
     }
-    n_reject[l] = p - sum(e2, p);
+    n_reject[l] = p - e2.size();
     
+    ws_thresh = thresh;
+    prof_phase(PH_SWEEP);
     while(iter[l] < max_iter) {
       while(iter[l] < max_iter){
+        act = e1.idx;
+        n_act = act.size();
+        ord.resize(n_act);
+        for (t = 0; t < n_act; t++) ord[t] = t;
+        viol.assign(n_act, 0.0);
+        if (gap_stop) {
+          c_act.resize(n_act);
+          ws_prev = R_PosInf;
+        }
+        if (accel) {
+          hist.resize(n_act * (K + 1));
+          extr.resize(n_act);
+          n_hist = 0;
+        }
         while(iter[l] < max_iter) {
           iter[l]++;
+          prof_sweep();
           
           //solve lasso over ever-active set
           max_update = 0.0;
-          for (j = 0; j < p; j++) {
-            if (e1[j]) {
-              jj = col_idx[j];
-              z[j] = crossprod_resid(xMat, r, sumResid, row_idx, center[jj], scale[jj], n, jj) / n + a[j];
-              l1 = lambda[l] * m[jj] * alpha;
-              l2 = lambda[l] * m[jj] * (1-alpha);
-              beta(j, l) = lasso(z[j], l1, l2, 1);
-              
-              shift = beta(j, l) - a[j];
-              if (shift !=0) {
-                // compute objective update for checking convergence
-                //update =  z[j] * shift - 0.5 * (1 + l2) * (pow(beta(j, l), 2) - pow(a[j], 2)) - l1 * (fabs(beta(j, l)) -  fabs(a[j]));
-                update = pow(beta(j, l) - a[j], 2);
-                if (update > max_update) {
-                  max_update = update;
-                }
-                update_resid(xMat, r, shift, row_idx, center[jj], scale[jj], n, jj); // update r
-                sumResid = sum(r, n); //update sum of residual
-                a[j] = beta(j, l); //update a
+          sweep_order(ord, viol, order);
+          for (k = 0; k < n_act; k++) {
+            t = ord[k];
+            j = act[t];
+            jj = col_idx[j];
+            z[j] = crossprod_resid(xMat, r, sumResid, row_idx, center[jj], scale[jj], n, jj) / n + a[j];
+            l1 = lambda[l] * m[jj] * alpha;
+            l2 = lambda[l] * m[jj] * (1-alpha);
+            beta(j, l) = lasso(z[j], l1, l2, 1);
+            if (order == 2) viol[t] = kkt_resid(z[j] - a[j], a[j], l1, l2);
+            
+            shift = beta(j, l) - a[j];
+            if (shift !=0) {
+              // compute objective update for checking convergence
+              //update =  z[j] * shift - 0.5 * (1 + l2) * (pow(beta(j, l), 2) - pow(a[j], 2)) - l1 * (fabs(beta(j, l)) -  fabs(a[j]));
+              update = pow(beta(j, l) - a[j], 2);
+              if (update > max_update) {
+                max_update = update;
               }
+              update_resid(xMat, r, shift, row_idx, center[jj], scale[jj], n, jj); // update r
+              sumResid = sum(r, n); //update sum of residual
+              a[j] = beta(j, l); //update a
             }
           }
           // Check for convergence
-          if (max_update < thresh) break;
+          if (gap_stop) {
+            // X_j'r/n = z_j - beta_j right after the update of coordinate j
+            for (t = 0; t < n_act; t++) c_act[t] = z[act[t]] - a[act[t]];
+            if (max_update == 0) break;
+            // stop once the gap is small enough or no longer shrinks
+            ws_gap = gap_gaussian(r, y, a, c_act, act, col_idx, m, lambda[l], alpha, n);
+            if (ws_gap < ws_thresh || ws_gap >= ws_prev) break;
+            ws_prev = ws_gap;
+          } else if (max_update < thresh) break;
+          
+          if (accel && n_act > 0) {
+            for (t = 0; t < n_act; t++) hist[n_hist * n_act + t] = a[act[t]];
+            if (++n_hist == K + 1) {
+              n_hist = 0;
+              if (anderson_extrapolate(&extr[0], hist, n_act, K)) {
+                // accept extrapolated point only if it decreases the objective
+                for (i = 0; i < n; i++) r_extr[i] = r[i];
+                for (t = 0; t < n_act; t++) {
+                  j = act[t];
+                  jj = col_idx[j];
+                  shift = extr[t] - a[j];
+                  if (shift != 0) update_resid(xMat, r_extr, shift, row_idx, center[jj], scale[jj], n, jj);
+                }
+                double obj = gLoss(r, n) / (2 * n) + enet_penalty(a, act, n_act, col_idx, m, lambda[l], alpha);
+                for (t = 0; t < n_act; t++) swap(a[act[t]], extr[t]);
+                double obj_extr = gLoss(r_extr, n) / (2 * n) + enet_penalty(a, act, n_act, col_idx, m, lambda[l], alpha);
+                if (obj_extr < obj) {
+                  swap(r, r_extr);
+                  sumResid = sum(r, n);
+                  for (t = 0; t < n_act; t++) beta(act[t], l) = a[act[t]];
+                  n_accel[l]++;
+                } else {
+                  for (t = 0; t < n_act; t++) swap(a[act[t]], extr[t]);
+                }
+              }
+            }
+          }
         }
         
         // Scan for violations in strong set
@@ -281,13 +355,25 @@ RcppExport SEXP cdfit_gaussian_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
       violations = check_rest_set(e1, e2, z, xMat, row_idx, col_idx, center, scale, a, lambda[l], sumResid, alpha, r, m, n, p);
       if (violations == 0) {
         loss[l] = gLoss(r, n);
+        if (gap_stop) {
+          // z of inactive features is up to date from the KKT scans
+          ws_crossprod(c_act, act, xMat, r, sumResid, row_idx, col_idx, center, scale, n);
+          for (j = 0; j < p; j++) c_all[j] = z[j];
+          for (t = 0; t < n_act; t++) c_all[act[t]] = c_act[t];
+          gap[l] = gap_gaussian(r, y, a, c_all, all, col_idx, m, lambda[l], alpha, n);
+          if (gap[l] >= thresh) {
+            // sweep the ever-active set to a smaller gap before scanning again
+            ws_thresh /= 2;
+            continue;
+          }
+        }
         break;
       }
     }
   }
   
-  Free(a); Free(r); Free(e1); Free(e2);
-  return List::create(beta, center, scale, lambda, loss, iter, n_reject, Rcpp::wrap(col_idx));
+  if (order == 1) PutRNGstate();
+  return List::create(beta, center, scale, lambda, loss, iter, n_reject, Rcpp::wrap(col_idx), n_accel, gap);
 }
 
 
@@ -296,8 +382,7 @@ RcppExport SEXP cdfit_gaussian_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
 RcppExport SEXP cdfit_gaussian_ada_edpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_, SEXP lambda_, SEXP nlambda_,
                                             SEXP lam_scale_, SEXP lambda_min_, SEXP alpha_, SEXP user_,
                                             SEXP eps_, SEXP max_iter_, SEXP multiplier_, SEXP dfmax_,
-                                            SEXP ncore_, SEXP update_thresh_, SEXP verbose_) {
-  //ProfilerStart("Ada_EDPP_SSR.out");
+                                            SEXP ncore_, SEXP update_thresh_, SEXP verbose_, SEXP io_) {
   XPtr<BigMatrix> xMat(X_);
   double *y = REAL(y_);
   int *row_idx = INTEGER(row_idx_);
@@ -339,6 +424,9 @@ RcppExport SEXP cdfit_gaussian_ada_edpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_, SEX
   omp_set_num_threads(useCores);
 #endif
   
+  ProfileFit pf(n, L);
+  IoOptions io(io_);
+  
   if (verbose) {
     char buff1[100];
     time_t now1 = time (0);
@@ -362,7 +450,7 @@ RcppExport SEXP cdfit_gaussian_ada_edpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_, SEX
   
   // Objects to be returned to R
   arma::sp_mat beta = arma::sp_mat(p, L); //Beta
-  double *a = Calloc(p, double); //Beta from previous iteration
+  WorkBuf<double> a(p); //Beta from previous iteration
   NumericVector loss(L);
   IntegerVector iter(L);
   IntegerVector n_reject(L);
@@ -371,11 +459,11 @@ RcppExport SEXP cdfit_gaussian_ada_edpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_, SEX
   double l1, l2, shift;
   double max_update, update, thresh; // for convergence check
   int i, j, jj, l, violations, lstart; //temp index
-  int *ever_active = Calloc(p, int); // ever-active set
-  int *strong_set = Calloc(p, int); // strong set
-  int *discard_beta = Calloc(p, int); // index set of discarded features;
-  int *discard_old = Calloc(p, int);
-  double *r = Calloc(n, double);
+  IndexSet ever_active(p); // ever-active set
+  IndexSet strong_set(p); // strong set
+  BitSet discard_beta(p); // index set of discarded features;
+  BitSet discard_old(p);
+  WorkBuf<double> r(n);
   for (i = 0; i < n; i++) r[i] = y[i];
   double sumResid = sum(r, n);
   loss[0] = gLoss(r, n);
@@ -383,15 +471,15 @@ RcppExport SEXP cdfit_gaussian_ada_edpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_, SEX
   
   // EDPP
   double c;
-  double *lhs2 = Calloc(p, double); //Second term on LHS
+  WorkBuf<double> lhs2(p); //Second term on LHS
   double rhs2 = 0.0; // second term on RHS
-  double *Xty = Calloc(p, double);
-  double *Xtr = Calloc(p, double); // Xtr at previous update of EDPP
+  WorkBuf<double> Xty(p);
+  WorkBuf<double> Xtr(p); // Xtr at previous update of EDPP
   for(j = 0; j < p; j++) {
     Xty[j] = z[j] * n;
     Xtr[j] = Xty[j];
   }
-  double *yhat = Calloc(n, double); // yhat at previous rupdate of EDPP
+  WorkBuf<double> yhat(n); // yhat at previous rupdate of EDPP
   double yhat_norm2;
   double ytyhat;
   double y_norm2 = 0; // ||y||^2
@@ -433,6 +521,7 @@ RcppExport SEXP cdfit_gaussian_ada_edpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_, SEX
   
   // Path
   for (l = lstart; l < L; l++) {
+    prof_lambda(l);
     if(verbose) {
       // output time
       char buff[100];
@@ -443,12 +532,11 @@ RcppExport SEXP cdfit_gaussian_ada_edpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_, SEX
     c = (lambda[l_prev] - lambda[l]) / lambda[l_prev] / lambda[l];
     if(l != lstart) {
       int nv = 0;
-      for (int j=0; j<p; j++) {
-        if (a[j] != 0) nv++;
+      for (int h = 0; h < ever_active.size(); h++) {
+        if (a[ever_active.idx[h]] != 0) nv++;
       }
       if (nv > dfmax) {
         for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
-        Free(ever_active); Free(r); Free(a); Free(discard_beta); Free(lhs2); Free(Xty); Free(Xtr); Free(yhat); Free(discard_old); Free(strong_set);
         return List::create(beta, center, scale, lambda, loss, iter,  n_reject, n_safe_reject, Rcpp::wrap(col_idx));
       }
       if(gain - n_safe_reject[l - 1] * (l - l_prev) > update_thresh * p && l != L - 1) { // Update EDPP if not discarding enough
@@ -484,7 +572,7 @@ RcppExport SEXP cdfit_gaussian_ada_edpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_, SEX
         // Reapply EDPP
         edpp_screen(discard_beta, n, p, rhs2, Xtr, lhs2, c,
                     1 / lambda[l_prev], m, alpha, col_idx);
-        n_safe_reject[l] = sum(discard_beta, p);
+        n_safe_reject[l] = discard_beta.count();
         gain = n_safe_reject[l];
       } else {
         // Apply EDPP to discard features
@@ -495,7 +583,7 @@ RcppExport SEXP cdfit_gaussian_ada_edpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_, SEX
           edpp_screen(discard_beta, n, p, rhs2, Xtr, lhs2, c,
                       (1 / lambda[l_prev] + 1 / lambda[l]) / 2, m, alpha, col_idx);
         }
-        n_safe_reject[l] = sum(discard_beta, p);
+        n_safe_reject[l] = discard_beta.count();
         gain += n_safe_reject[l];
       }
       
@@ -507,11 +595,9 @@ RcppExport SEXP cdfit_gaussian_ada_edpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_, SEX
         strftime (buff, 100, "%Y-%m-%d %H:%M:%S.000", localtime (&now));
         Rprintf("Start calculating BEDPP rule. Now time: %s\n", buff);
       }
-      double xjtx;
+      crossprod_xmax(lhs2, xMat, xmax_idx, row_idx, col_idx, center, scale, n, p);
       for(j = 0; j < p; j ++) {
-        jj = col_idx[j];
-        xjtx = crossprod_bm_Xj_Xk(xMat, row_idx, center, scale, n, jj, xmax_idx);
-        lhs2[j] = -xty * lambda[l] * xjtx;
+        lhs2[j] = -xty * lambda[l] * lhs2[j];
       }
       rhs2 = sqrt(n * y_norm2 - pow(n * lambda[l], 2));
       if(verbose) {
@@ -523,7 +609,7 @@ RcppExport SEXP cdfit_gaussian_ada_edpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_, SEX
       }
       edpp_screen(discard_beta, n, p, rhs2, Xtr, lhs2, c,
                   1 / lambda[l_prev], m, alpha, col_idx);
-      n_safe_reject[l] = sum(discard_beta, p);
+      n_safe_reject[l] = discard_beta.count();
       gain = n_safe_reject[l];
     }
     
@@ -531,47 +617,43 @@ RcppExport SEXP cdfit_gaussian_ada_edpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_, SEX
     //update_zj(z, discard_beta, discard_old, xMat, row_idx, col_idx, center, scale, 
     //sumResid, r, m, n, p);
     if(l != lstart) cutoff = 2 * lambda[l] - lambda[l-1];
+    strong_set.clear();
     for(j = 0; j < p; j++) {
-      if(discard_beta[j]) continue;
+      if(discard_beta.test(j)) continue;
       if(fabs(z[j]) > cutoff * alpha * m[col_idx[j]]) {
-        strong_set[j] = 1;
-      } else {
-        strong_set[j] = 0;
+        strong_set.add(j);
       }
     }
-    n_reject[l] = p - sum(strong_set, p);
-    for(j = 0; j < p; j++) discard_old[j] = discard_beta[j];
+    n_reject[l] = p - strong_set.size();
+    discard_old = discard_beta;
     
+    prof_phase(PH_SWEEP);
     while(iter[l] < max_iter) {
       while (iter[l] < max_iter) {
         while (iter[l] < max_iter) {
           iter[l]++;
+          prof_sweep();
           
           max_update = 0.0;
-          for (j = 0; j < p; j++) {
-            if (ever_active[j]) {
-              jj = col_idx[j];
-              z[j] = crossprod_resid(xMat, r, sumResid, row_idx, center[jj], scale[jj], n, jj) / n + a[j];
-              l1 = lambda[l] * m[jj] * alpha;
-              l2 = lambda[l] * m[jj] * (1-alpha);
-              beta(j, l) = lasso(z[j], l1, l2, 1);
-              
-              shift = beta(j, l) - a[j];
-              if (shift != 0) {
-                // compute objective update for checking convergence
-                //update =  z[j] * shift - 0.5 * (1 + l2) * (pow(beta(j, l+1), 2) - pow(a[j], 2)) - l1 * (fabs(beta(j, l+1)) -  fabs(a[j]));
-                update = pow(beta(j, l) - a[j], 2);
-                if (update > max_update) {
-                  max_update = update;
-                }
-                update_resid(xMat, r, shift, row_idx, center[jj], scale[jj], n, jj);
-                sumResid = sum(r, n); //update sum of residual
-                a[j] = beta(j, l); //update a
+          for (int h = 0; h < ever_active.size(); h++) {
+            j = ever_active.idx[h];
+            jj = col_idx[j];
+            z[j] = crossprod_resid(xMat, r, sumResid, row_idx, center[jj], scale[jj], n, jj) / n + a[j];
+            l1 = lambda[l] * m[jj] * alpha;
+            l2 = lambda[l] * m[jj] * (1-alpha);
+            beta(j, l) = lasso(z[j], l1, l2, 1);
+            
+            shift = beta(j, l) - a[j];
+            if (shift != 0) {
+              // compute objective update for checking convergence
+              //update =  z[j] * shift - 0.5 * (1 + l2) * (pow(beta(j, l+1), 2) - pow(a[j], 2)) - l1 * (fabs(beta(j, l+1)) -  fabs(a[j]));
+              update = pow(beta(j, l) - a[j], 2);
+              if (update > max_update) {
+                max_update = update;
               }
-              // update ever active sets
-              if (beta(j, l) != 0) {
-                ever_active[j] = 1;
-              } 
+              update_resid(xMat, r, shift, row_idx, center[jj], scale[jj], n, jj);
+              sumResid = sum(r, n); //update sum of residual
+              a[j] = beta(j, l); //update a
             }
           }
           // Check for convergence
@@ -590,8 +672,6 @@ RcppExport SEXP cdfit_gaussian_ada_edpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_, SEX
     }
   }
   
-  Free(ever_active); Free(r); Free(a); Free(discard_beta); Free(lhs2); Free(Xty); Free(Xtr); Free(yhat); Free(discard_old); Free(strong_set);
-  //ProfilerStop();
   return List::create(beta, center, scale, lambda, loss, iter, n_reject, n_safe_reject, Rcpp::wrap(col_idx));
 }
 
@@ -604,8 +684,7 @@ RcppExport SEXP cdfit_gaussian_bedpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
                                          SEXP max_iter_, SEXP multiplier_, 
                                          SEXP dfmax_, SEXP ncore_, 
                                          SEXP safe_thresh_,
-                                         SEXP verbose_) {
-  //ProfilerStart("HSR.out");
+                                         SEXP verbose_, SEXP io_) {
   XPtr<BigMatrix> xMat(X_);
   double *y = REAL(y_);
   int *row_idx = INTEGER(row_idx_);
@@ -646,6 +725,9 @@ RcppExport SEXP cdfit_gaussian_bedpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
   omp_set_num_threads(useCores);
 #endif
   
+  ProfileFit pf(n, L);
+  IoOptions io(io_);
+  
   if (verbose) {
     char buff1[100];
     time_t now1 = time (0);
@@ -669,7 +751,7 @@ RcppExport SEXP cdfit_gaussian_bedpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
   
   // Objects to be returned to R
   arma::sp_mat beta = arma::sp_mat(p, L); // Beta
-  double *a = Calloc(p, double); //Beta from previous iteration
+  WorkBuf<double> a(p); //Beta from previous iteration
   NumericVector loss(L);
   IntegerVector iter(L);
   IntegerVector n_reject(L); // number of total rejections;
@@ -678,9 +760,9 @@ RcppExport SEXP cdfit_gaussian_bedpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
   double l1, l2, cutoff, shift;
   double max_update, update, thresh; // for convergence check
   int i, j, jj, l, violations, lstart; 
-  int *e1 = Calloc(p, int); // ever-active set
-  int *e2 = Calloc(p, int); // strong set
-  double *r = Calloc(n, double);
+  IndexSet e1(p); // ever-active set
+  IndexSet e2(p); // strong set
+  WorkBuf<double> r(n);
   for (i = 0; i < n; i++) r[i] = y[i];
   double sumResid = sum(r, n);
   loss[0] = gLoss(r,n);
@@ -713,8 +795,8 @@ RcppExport SEXP cdfit_gaussian_bedpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
   vector<double> xty;
   vector<double> sign_lammax_xtxmax;
   double ynorm_sq = 0;
-  int *bedpp_reject = Calloc(p, int);
-  int *bedpp_reject_old = Calloc(p, int);
+  BitSet bedpp_reject(p);
+  BitSet bedpp_reject_old(p);
   int bedpp; // if 0, don't perform bedpp test
   if (bedpp_thresh < 1) {
     bedpp = 1; // turn on bedpp test
@@ -733,6 +815,7 @@ RcppExport SEXP cdfit_gaussian_bedpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
   
   // Path
   for (l = lstart; l < L; l++) {
+    prof_lambda(l);
     if(verbose) {
       // output time
       char buff[100];
@@ -744,12 +827,11 @@ RcppExport SEXP cdfit_gaussian_bedpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
     if (l != 0) {
       // Check dfmax
       int nv = 0;
-      for (j = 0; j < p; j++) {
-        if (a[j] != 0) nv++;
+      for (int h = 0; h < e1.size(); h++) {
+        if (a[e1.idx[h]] != 0) nv++;
       }
       if (nv > dfmax) {
         for (int ll = l; ll < L; ll++) iter[ll] = NA_INTEGER;
-        Free(a); Free(r); Free(e1); Free(e2); Free(bedpp_reject); Free(bedpp_reject_old);
         return List::create(beta, center, scale, lambda, loss, iter, 
                             n_reject, n_bedpp_reject, Rcpp::wrap(col_idx));
       }
@@ -760,63 +842,60 @@ RcppExport SEXP cdfit_gaussian_bedpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
     
     if (bedpp) {
       bedpp_screen(bedpp_reject, sign_lammax_xtxmax, xty, ynorm_sq, row_idx, col_idx, lambda[l], lambda_max, alpha, n, p);
-      n_bedpp_reject[l] = sum(bedpp_reject, p);
+      n_bedpp_reject[l] = bedpp_reject.count();
       
       // update z[j] for features which are rejected at previous lambda but accepted at current one.
       update_zj(z, bedpp_reject, bedpp_reject_old, xMat, row_idx, col_idx, center, scale, sumResid, r, m, n, p);
       
-#pragma omp parallel for private(j) schedule(static) 
+      // update bedpp_reject_old with bedpp_reject
+      bedpp_reject_old = bedpp_reject;
+      e2.clear();
       for (j = 0; j < p; j++) {
-        // update bedpp_reject_old with bedpp_reject
-        bedpp_reject_old[j] = bedpp_reject[j];
         // hsr screening
-        if (bedpp_reject[j] == 0 && (fabs(z[j]) >= (cutoff * alpha * m[col_idx[j]]))) {
-          e2[j] = 1;
-        } else {
-          e2[j] = 0;
+        if (bedpp_reject.test(j) == 0 && (fabs(z[j]) >= (cutoff * alpha * m[col_idx[j]]))) {
+          e2.add(j);
         }
       }
     } else {
       n_bedpp_reject[l] = 0; // no bedpp test;
       // hsr screening over all
-#pragma omp parallel for private(j) schedule(static) 
+      e2.clear();
       for (j = 0; j < p; j++) {
         if (fabs(z[j]) >= (cutoff * alpha * m[col_idx[j]])) {
-          e2[j] = 1;
-        } else {
-          e2[j] = 0;
+          e2.add(j);
         }
       }
     }
-    n_reject[l] = p - sum(e2, p); // e2 set means not reject by bedpp or hsr;
+    n_reject[l] = p - e2.size(); // e2 set means not reject by bedpp or hsr;
     
+    prof_phase(PH_SWEEP);
     while(iter[l] < max_iter) {
       while(iter[l] < max_iter){
         while(iter[l] < max_iter) {
           iter[l]++;
+          prof_sweep();
           
           //solve lasso over ever-active set
           max_update = 0.0;
-          for (j = 0; j < p; j++) {
-            if (e1[j]) { 
-              jj = col_idx[j];
-              z[j] = crossprod_resid(xMat, r, sumResid, row_idx, center[jj], scale[jj], n, jj) / n + a[j];
-              l1 = lambda[l] * m[jj] * alpha;
-              l2 = lambda[l] * m[jj] * (1-alpha);
-              beta(j, l) = lasso(z[j], l1, l2, 1);
-              
-              shift = beta(j, l) - a[j];
-              if (shift !=0) {
-                // compute objective update for checking convergence
-                //update =  z[j] * shift - 0.5 * (1 + l2) * (pow(beta(j, l), 2) - pow(a[j], 2)) - l1 * (fabs(beta(j, l)) -  fabs(a[j]));
-                update = pow(beta(j, l) - a[j], 2);
-                if (update > max_update) {
-                  max_update = update;
-                }
-                update_resid(xMat, r, shift, row_idx, center[jj], scale[jj], n, jj); // Update r
-                sumResid = sum(r, n); //update sum of residual
-                a[j] = beta(j, l); //update a
+          for (int h = 0; h < e1.size(); h++) {
+            j = e1.idx[h];
+            jj = col_idx[j];
+            z[j] = crossprod_resid(xMat, r, sumResid, row_idx, center[jj], scale[jj], n, jj) / n + a[j];
+            l1 = lambda[l] * m[jj] * alpha;
+            l2 = lambda[l] * m[jj] * (1-alpha);
+            beta(j, l) = lasso(z[j], l1, l2, 1);
+            
+            shift = beta(j, l) - a[j];
+            if (shift !=0) {
+              // compute objective update for checking convergence
+              //update =  z[j] * shift - 0.5 * (1 + l2) * (pow(beta(j, l), 2) - pow(a[j], 2)) - l1 * (fabs(beta(j, l)) -  fabs(a[j]));
+              update = pow(beta(j, l) - a[j], 2);
+              if (update > max_update) {
+                max_update = update;
               }
+              update_resid(xMat, r, shift, row_idx, center[jj], scale[jj], n, jj); // Update r
+              sumResid = sum(r, n); //update sum of residual
+              a[j] = beta(j, l); //update a
             }
           }
           // Check for convergence
@@ -846,7 +925,644 @@ RcppExport SEXP cdfit_gaussian_bedpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
     }
   }
   
-  Free(a); Free(r); Free(e1); Free(e2); Free(bedpp_reject); Free(bedpp_reject_old);
-  //ProfilerStop();
   return List::create(beta, center, scale, lambda, loss, iter, n_reject, n_bedpp_reject, Rcpp::wrap(col_idx));
 }
+
+// Coordinate descent for gaussian models with working set
+RcppExport SEXP cdfit_gaussian_ws(SEXP X_, SEXP y_, SEXP row_idx_, 
+                                  SEXP lambda_, SEXP nlambda_, 
+                                  SEXP lam_scale_, SEXP lambda_min_, 
+                                  SEXP alpha_, SEXP user_, SEXP eps_, 
+                                  SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
+                                  SEXP ncore_, SEXP verbose_, SEXP io_) {
+  XPtr<BigMatrix> xMat(X_);
+  double *y = REAL(y_);
+  int *row_idx = INTEGER(row_idx_);
+  double lambda_min = REAL(lambda_min_)[0];
+  double alpha = REAL(alpha_)[0];
+  int n = Rf_length(row_idx_); // number of observations used for fitting model
+  
+  int p = xMat->ncol();
+  int L = INTEGER(nlambda_)[0];
+  int lam_scale = INTEGER(lam_scale_)[0];
+  int user = INTEGER(user_)[0];
+  int verbose = INTEGER(verbose_)[0];
+  double eps = REAL(eps_)[0];
+  int max_iter = INTEGER(max_iter_)[0];
+  double *m = REAL(multiplier_);
+  int dfmax = INTEGER(dfmax_)[0];
+  
+  NumericVector lambda(L);
+  NumericVector center(p);
+  NumericVector scale(p);
+  int p_keep = 0;
+  int *p_keep_ptr = &p_keep;
+  vector<int> col_idx;
+  vector<double> z;
+  double lambda_max = 0.0;
+  double *lambda_max_ptr = &lambda_max;
+  int xmax_idx = 0;
+  int *xmax_ptr = &xmax_idx;
+  
+  // set up omp
+  int useCores = INTEGER(ncore_)[0];
+#ifdef BIGLASSO_OMP_H_
+  int haveCores = omp_get_num_procs();
+  if(useCores < 1) {
+    useCores = haveCores;
+  }
+  omp_set_dynamic(0);
+  omp_set_num_threads(useCores);
+#endif
+  
+  ProfileFit pf(n, L);
+  IoOptions io(io_);
+  
+  if (verbose) {
+    char buff1[100];
+    time_t now1 = time (0);
+    strftime (buff1, 100, "%Y-%m-%d %H:%M:%S.000", localtime (&now1));
+    Rprintf("\nPreprocessing start: %s\n", buff1);
+  }
+  
+  // standardize: get center, scale; get p_keep_ptr, col_idx; get z, lambda_max, xmax_idx;
+  standardize_and_get_residual(center, scale, p_keep_ptr, col_idx, z, lambda_max_ptr, xmax_ptr, xMat, 
+                               y, row_idx, lambda_min, alpha, n, p);
+  
+  p = p_keep;   // set p = p_keep, only loop over columns whose scale > 1e-6
+  
+  if (verbose) {
+    char buff1[100];
+    time_t now1 = time (0);
+    strftime (buff1, 100, "%Y-%m-%d %H:%M:%S.000", localtime (&now1));
+    Rprintf("Preprocessing end: %s\n", buff1);
+    Rprintf("\n-----------------------------------------------\n");
+  }
+  
+  // Objects to be returned to R
+  arma::sp_mat beta = arma::sp_mat(p, L); // beta
+  WorkBuf<double> a(p); //Beta from previous iteration
+  NumericVector loss(L);
+  IntegerVector iter(L);
+  IntegerVector n_reject(L);
+  
+  double l1, l2, shift;
+  double max_update, update, thresh; // for convergence check
+  int i, j, jj, k, l, violations, lstart;
+  int ws_min = 100, gap_freq = 10, ws_size, nws = 0;
+  IndexSet in_ws(p); // working set indicator
+  vector<int> ws, cand(p); // working set, candidate buffer
+  vector<double> c; // X_j' r / n over working set
+  WorkBuf<double> r(n);
+  for (i = 0; i < n; i++) r[i] = y[i];
+  double sumResid = sum(r, n);
+  loss[0] = gLoss(r,n);
+  thresh = eps * loss[0] / n;
+  
+  // set up lambda
+  if (user == 0) {
+    if (lam_scale) { // set up lambda, equally spaced on log scale
+      double log_lambda_max = log(lambda_max);
+      double log_lambda_min = log(lambda_min*lambda_max);
+      
+      double delta = (log_lambda_max - log_lambda_min) / (L-1);
+      for (l = 0; l < L; l++) {
+        lambda[l] = exp(log_lambda_max - l * delta);
+      }
+    } else { // equally spaced on linear scale
+      double delta = (lambda_max - lambda_min*lambda_max) / (L-1);
+      for (l = 0; l < L; l++) {
+        lambda[l] = lambda_max - l * delta;
+      }
+    }
+    lstart = 1;
+    n_reject[0] = p;
+  } else {
+    lstart = 0;
+    lambda = Rcpp::as<NumericVector>(lambda_);
+  }
+  
+  // Path
+  for (l = lstart; l < L; l++) {
+    prof_lambda(l);
+    if(verbose) {
+      // output time
+      char buff[100];
+      time_t now = time (0);
+      strftime (buff, 100, "%Y-%m-%d %H:%M:%S.000", localtime (&now));
+      Rprintf("Lambda %d. Now time: %s\n", l, buff);
+    }
+    // Check dfmax; only the working set of the previous lambda can be nonzero
+    int nv = 0;
+    for (int h = 0; h < nws; h++) {
+      if (a[ws[h]] != 0) nv++;
+    }
+    if (l != 0 && nv > dfmax) {
+      for (int ll=l; ll<L; ll++) iter[ll] = NA_INTEGER;
+      return List::create(beta, center, scale, lambda, loss, iter, n_reject, Rcpp::wrap(col_idx));
+    }
+    // working set: active features plus those closest to violating KKT
+    ws_size = 2 * nv > ws_min ? 2 * nv : ws_min;
+    nws = ws_select(ws, in_ws, cand, z, a, col_idx, m, lambda[l], alpha, ws_size, p);
+    
+    prof_phase(PH_SWEEP);
+    while(iter[l] < max_iter) {
+      while(iter[l] < max_iter) {
+        iter[l]++;
+        prof_sweep();
+        
+        //solve lasso over working set
+        max_update = 0.0;
+        for (k = 0; k < nws; k++) {
+          j = ws[k];
+          jj = col_idx[j];
+          z[j] = crossprod_resid(xMat, r, sumResid, row_idx, center[jj], scale[jj], n, jj) / n + a[j];
+          l1 = lambda[l] * m[jj] * alpha;
+          l2 = lambda[l] * m[jj] * (1-alpha);
+          beta(j, l) = lasso(z[j], l1, l2, 1);
+          
+          shift = beta(j, l) - a[j];
+          if (shift !=0) {
+            update = pow(beta(j, l) - a[j], 2);
+            if (update > max_update) {
+              max_update = update;
+            }
+            update_resid(xMat, r, shift, row_idx, center[jj], scale[jj], n, jj); // update r
+            sumResid = sum(r, n); //update sum of residual
+            a[j] = beta(j, l); //update a
+          }
+        }
+        // Check for convergence
+        if (max_update < thresh) break;
+        // duality gap on the working set, checked every gap_freq sweeps
+        if (iter[l] % gap_freq == 0) {
+          ws_crossprod(c, ws, xMat, r, sumResid, row_idx, col_idx, center, scale, n);
+          if (gap_gaussian(r, y, a, c, ws, col_idx, m, lambda[l], alpha, n) < thresh) break;
+        }
+      }
+      
+      // Scan for violations outside working set
+      violations = check_rest_set(in_ws, in_ws, z, xMat, row_idx, col_idx, center, scale, a, lambda[l], sumResid, alpha, r, m, n, p);
+      if (violations == 0) {
+        loss[l] = gLoss(r, n);
+        break;
+      }
+      // grow working set, violators have the smallest margins
+      ws_size = 2 * nws > nws + violations ? 2 * nws : nws + violations;
+      nws = ws_select(ws, in_ws, cand, z, a, col_idx, m, lambda[l], alpha, ws_size, p);
+    }
+    n_reject[l] = p - nws;
+  }
+  
+  return List::create(beta, center, scale, lambda, loss, iter, n_reject, Rcpp::wrap(col_idx));
+}
+
+// Several linear regression paths that share every pass over X: the columns
+// of a response matrix (family = "mgaussian"), or one response under several
+// values of alpha. The residuals of the K paths are kept row-major,
+// r[i * K + k], so that one read of column j gives X_j'R for every path and
+// the residual update after a step runs over contiguous rows. Path k has its
+// own alpha, lambda grid, convergence threshold and dfmax stop; the strong and
+// ever-active sets are shared, i.e. the union over the paths. With group = 1
+// the coefficients b_j of feature j across the paths form a group with penalty
+// lambda * m_j * (alpha * ||b_j|| + (1 - alpha) / 2 * ||b_j||^2), so that the
+// responses share their support.
+
+// zj[k] = X_j'r_k / n for all paths
+static void crossprod_resid_multi(double *zj, double *xCol, double *r, double *sumResid,
+                                  int *row_idx, double center_, double scale_, int n, int K) {
+  int i, k;
+  double x, *ri;
+  for (k = 0; k < K; k++) zj[k] = 0.0;
+  for (i = 0; i < n; i++) {
+    x = xCol[row_idx[i]];
+    ri = r + (size_t) i * K;
+    for (k = 0; k < K; k++) zj[k] += x * ri[k];
+  }
+  for (k = 0; k < K; k++) zj[k] = (zj[k] - center_ * sumResid[k]) / (scale_ * n);
+}
+
+// r_k -= shift[k] * x_j for all paths, and the sums of the new residuals
+static void update_resid_multi(double *r, double *sumResid, double *shift, double *xCol,
+                               int *row_idx, double center_, double scale_, int n, int K) {
+  int i, k;
+  double x, *ri;
+  for (k = 0; k < K; k++) sumResid[k] = 0.0;
+  for (i = 0; i < n; i++) {
+    x = (xCol[row_idx[i]] - center_) / scale_;
+    ri = r + (size_t) i * K;
+    for (k = 0; k < K; k++) {
+      ri[k] -= shift[k] * x;
+      sumResid[k] += ri[k];
+    }
+  }
+}
+
+// whether zj exceeds the level lev[k] * mj of a running path: by its norm for
+// the group penalty, entry by entry otherwise
+static int z_exceeds(double *zj, double *lev, double mj, int *run, int K, int group) {
+  if (group) {
+    double s = 0.0;
+    for (int k = 0; k < K; k++) s += zj[k] * zj[k];
+    return run[0] && sqrt(s) > lev[0] * mj;
+  }
+  for (int k = 0; k < K; k++) {
+    if (run[k] && fabs(zj[k]) > lev[k] * mj) return 1;
+  }
+  return 0;
+}
+
+// center, scale and z = X'Y / n in one pass over the columns; zmax is the
+// largest norm (group) or entry of the z_j
+static void standardize_multi(NumericVector &center, NumericVector &scale,
+                              vector<int> &col_idx, vector<double> &z, double *zmax_ptr,
+                              XPtr<BigMatrix> xMat, double *y, int *row_idx,
+                              int group, int n, int p, int K) {
+  double *xCol;
+  vector<double> sum_y(K, 0.0), sum_xy((size_t) p * K);
+  double zmax = 0.0, zs, zjk;
+  int i, j, k, c, nb;
+  
+  for (i = 0; i < n; i++) {
+    for (k = 0; k < K; k++) sum_y[k] += y[(size_t) i * K + k];
+  }
+  
+  vector<int> all(p);
+  for (j = 0; j < p; j++) all[j] = j;
+  ColumnStream cs(xMat, all, NULL, p);
+  prof_reads(p);
+  while (cs.next()) {
+    nb = cs.size();
+#pragma omp parallel for private(i, j, k, c, xCol) schedule(static)
+    for (c = 0; c < nb; c++) {
+      j = cs.col(c);
+      xCol = cs.data(c);
+      double *sj = &sum_xy[(size_t) j * K], x;
+      for (k = 0; k < K; k++) sj[k] = 0.0;
+      for (i = 0; i < n; i++) {
+        x = xCol[row_idx[i]];
+        center[j] += x;
+        scale[j] += x * x;
+        for (k = 0; k < K; k++) sj[k] += x * y[(size_t) i * K + k];
+      }
+      center[j] = center[j] / n; //center
+      scale[j] = sqrt(scale[j] / n - pow(center[j], 2)); //scale
+    }
+  }
+  
+  for (j = 0; j < p; j++) {
+    if (scale[j] > 1e-6) {
+      col_idx.push_back(j);
+      zs = 0.0;
+      for (k = 0; k < K; k++) {
+        zjk = (sum_xy[(size_t) j * K + k] - center[j] * sum_y[k]) / (scale[j] * n);
+        z.push_back(zjk);
+        if (group) zs += zjk * zjk;
+        else if (fabs(zjk) > zs) zs = fabs(zjk);
+      }
+      if (group) zs = sqrt(zs);
+      if (zs > zmax) zmax = zs;
+    }
+  }
+  *zmax_ptr = zmax;
+}
+
+// z of the features outside skip, streamed once for all paths
+static void scan_z_multi(vector<double> &z, BitSet *skip, XPtr<BigMatrix> xpMat, int *row_idx,
+                         vector<int> &col_idx, NumericVector &center, NumericVector &scale,
+                         double *sumResid, double *r, int n, int p, int K) {
+  ColumnStream cs(xpMat, col_idx, skip, p);
+  NodeCopies rc(r, (size_t) n * K);
+  while (cs.next()) {
+    prof_reads(cs.size());
+#pragma omp parallel OMP_SPREAD
+    {
+      double *rl = rc.get();
+      int j, jj, c, lo, hi;
+      cs.range(omp_get_thread_num(), omp_get_num_threads(), &lo, &hi);
+      for (c = lo; c < hi; c++) {
+        j = cs.col(c);
+        jj = col_idx[j];
+        crossprod_resid_multi(&z[(size_t) j * K], cs.data(c), rl, sumResid, row_idx,
+                              center[jj], scale[jj], n, K);
+      }
+    }
+  }
+}
+
+// Coordinate descent with sequential strong rule for K paths on the
+// responses r (n x K, row-major). Returns beta (row k * p + j),
+// center, scale, lambda, loss and iter (L x K), n_reject and col_idx.
+static List cdfit_multi(XPtr<BigMatrix> xMat, double *r, int *row_idx, vector<double> &alpha,
+                        SEXP lambda_, int L, int lam_scale, double lambda_min, int user,
+                        double eps, int max_iter, double *m, int dfmax, int group,
+                        int verbose, int n, int K) {
+  MatrixAccessor<double> xAcc(*xMat);
+  int p = xMat->ncol();
+  ProfileFit pf(n, L);
+  NumericVector lambda((size_t) L * K); // L x K
+  NumericVector center(p);
+  NumericVector scale(p);
+  vector<int> col_idx;
+  vector<double> z; // z[j * K + k]
+  double zmax = 0.0;
+  
+  if (verbose) {
+    char buff1[100];
+    time_t now1 = time (0);
+    strftime (buff1, 100, "%Y-%m-%d %H:%M:%S.000", localtime (&now1));
+    Rprintf("\nPreprocessing start: %s\n", buff1);
+  }
+  
+  standardize_multi(center, scale, col_idx, z, &zmax, xMat, r, row_idx, group, n, p, K);
+  
+  p = col_idx.size();   // only loop over columns whose scale > 1e-6
+  
+  if (verbose) {
+    char buff1[100];
+    time_t now1 = time (0);
+    strftime (buff1, 100, "%Y-%m-%d %H:%M:%S.000", localtime (&now1));
+    Rprintf("Preprocessing end: %s\n", buff1);
+    Rprintf("\n-----------------------------------------------\n");
+  }
+  
+  // Objects to be returned to R
+  arma::sp_mat beta = arma::sp_mat((size_t) p * K, L); // row k * p + j
+  WorkBuf<double> a((size_t) p * K); //Beta from previous iteration
+  NumericVector loss((size_t) L * K); // L x K
+  IntegerVector iter((size_t) L * K); // L x K
+  IntegerVector n_reject(L);
+  
+  double l1, l2, nrm, update, *zj, *aj;
+  int i, j, jj, k, l, t, ll, nv, violations, lstart, converged, moved, swept;
+  vector<double> b(K), shift(K), max_update(K), thresh(K), sumResid(K, 0.0), lev(K);
+  vector<int> run(K, 1); // paths not stopped by dfmax
+  IndexSet e1(p); // ever active set
+  IndexSet e2(p); // strong set
+  vector<int> act;
+  for (i = 0; i < n; i++) {
+    for (k = 0; k < K; k++) {
+      sumResid[k] += r[(size_t) i * K + k];
+      loss[k * L] += pow(r[(size_t) i * K + k], 2);
+    }
+  }
+  for (k = 0; k < K; k++) thresh[k] = eps * loss[k * L] / n;
+  if (group) { // one criterion on the whole block
+    for (k = 1; k < K; k++) thresh[0] += thresh[k];
+  }
+  
+  // set up lambda, a grid from lambda_max = zmax / alpha for each path
+  for (k = 0; k < K; k++) {
+    double lambda_max = zmax / alpha[k];
+    if (user == 0) {
+      if (lam_scale) { // set up lambda, equally spaced on log scale
+        double log_lambda_max = log(lambda_max);
+        double log_lambda_min = log(lambda_min*lambda_max);
+        
+        double delta = (log_lambda_max - log_lambda_min) / (L-1);
+        for (l = 0; l < L; l++) {
+          lambda[k * L + l] = exp(log_lambda_max - l * delta);
+        }
+      } else { // equally spaced on linear scale
+        double delta = (lambda_max - lambda_min*lambda_max) / (L-1);
+        for (l = 0; l < L; l++) {
+          lambda[k * L + l] = lambda_max - l * delta;
+        }
+      }
+    } else {
+      for (l = 0; l < L; l++) lambda[k * L + l] = REAL(lambda_)[l];
+    }
+  }
+  if (user == 0) {
+    lstart = 1;
+    n_reject[0] = p;
+  } else {
+    lstart = 0;
+  }
+  
+  // Path
+  for (l = lstart; l < L; l++) {
+    prof_lambda(l);
+    if(verbose) {
+      // output time
+      char buff[100];
+      time_t now = time (0);
+      strftime (buff, 100, "%Y-%m-%d %H:%M:%S.000", localtime (&now));
+      Rprintf("Lambda %d. Now time: %s\n", l, buff);
+    }
+    // Check dfmax of each path
+    for (k = 0; k < K; k++) {
+      if (l == 0 || run[k] == 0) continue;
+      nv = 0;
+      for (int h = 0; h < e1.size(); h++) {
+        if (a[(size_t) e1.idx[h] * K + k] != 0) nv++;
+      }
+      if (nv > dfmax) run[k] = 0;
+    }
+    for (k = 0; k < K; k++) {
+      if (group) run[k] = run[0]; // the paths of a group stop together
+      if (run[k] == 0 && iter[k * L + l] != NA_INTEGER) {
+        for (ll = l; ll < L; ll++) iter[k * L + ll] = NA_INTEGER;
+      }
+    }
+    for (k = 0; k < K && run[k] == 0; k++);
+    if (k == K) break;
+    
+    // strong set
+    for (k = 0; k < K; k++) {
+      double lam_prev = l != 0 ? lambda[k * L + l - 1] : zmax / alpha[k];
+      lev[k] = (2 * lambda[k * L + l] - lam_prev) * alpha[k];
+    }
+    e2.clear();
+    for (j = 0; j < p; j++) {
+      if (z_exceeds(&z[(size_t) j * K], &lev[0], m[col_idx[j]], &run[0], K, group)) {
+        e2.add(j);
+      }
+    }
+    n_reject[l] = p - e2.size();
+    for (k = 0; k < K; k++) lev[k] = lambda[k * L + l] * alpha[k];
+    
+    prof_phase(PH_SWEEP);
+    swept = 0;
+    while(swept < max_iter) {
+      while(swept < max_iter){
+        act = e1.idx;
+        while(swept < max_iter) {
+          swept++;
+          prof_sweep();
+          
+          //solve over ever-active set, all paths per read of X_j
+          max_update.assign(K, 0.0);
+          for (t = 0; t < (int) act.size(); t++) {
+            j = act[t];
+            jj = col_idx[j];
+            zj = &z[(size_t) j * K];
+            aj = a + (size_t) j * K;
+            crossprod_resid_multi(zj, xAcc[jj], r, &sumResid[0], row_idx, center[jj], scale[jj], n, K);
+            prof_reads(1);
+            for (k = 0; k < K; k++) zj[k] += aj[k];
+            if (group) {
+              l1 = lambda[l] * m[jj] * alpha[0];
+              l2 = lambda[l] * m[jj] * (1-alpha[0]);
+              nrm = 0.0;
+              for (k = 0; k < K; k++) nrm += zj[k] * zj[k];
+              nrm = sqrt(nrm);
+              for (k = 0; k < K; k++) b[k] = nrm > l1 ? zj[k] * (1 - l1 / nrm) / (1 + l2) : 0.0;
+            } else {
+              for (k = 0; k < K; k++) {
+                l1 = lambda[k * L + l] * m[jj] * alpha[k];
+                l2 = lambda[k * L + l] * m[jj] * (1-alpha[k]);
+                b[k] = run[k] ? lasso(zj[k], l1, l2, 1) : aj[k];
+              }
+            }
+            
+            moved = 0;
+            update = 0.0;
+            for (k = 0; k < K; k++) {
+              shift[k] = b[k] - aj[k];
+              if (shift[k] != 0) moved = 1;
+              if (group) update += pow(shift[k], 2);
+              else if (pow(shift[k], 2) > max_update[k]) max_update[k] = pow(shift[k], 2);
+            }
+            if (group && update > max_update[0]) max_update[0] = update;
+            if (moved) {
+              update_resid_multi(r, &sumResid[0], &shift[0], xAcc[jj], row_idx,
+                                 center[jj], scale[jj], n, K);
+              prof_reads(1);
+              for (k = 0; k < K; k++) aj[k] = b[k]; //update a
+            }
+          }
+          // Check for convergence of every running path
+          converged = 1;
+          for (k = 0; k < (group ? 1 : K); k++) {
+            if (run[k] && max_update[k] >= thresh[k]) converged = 0;
+          }
+          if (converged) break;
+        }
+        
+        // Scan for violations in strong set
+        prof_phase(PH_KKT);
+        violations = 0;
+        int ns = e2.size();
+        BitSet skip = e1.mask; // only the strong features not yet active are read
+        for (t = 0; t < skip.nwords(); t++) skip.w[t] |= ~e2.mask.w[t];
+        scan_z_multi(z, &skip, xMat, row_idx, col_idx, center, scale, &sumResid[0], r, n, p, K);
+        for (t = 0; t < ns; t++) {
+          j = e2.idx[t];
+          if (e1.has(j) == 0 &&
+              z_exceeds(&z[(size_t) j * K], &lev[0], m[col_idx[j]], &run[0], K, group)) {
+            e1.add(j);
+            violations++;
+          }
+        }
+        prof_violations(violations);
+        prof_phase(PH_SWEEP);
+        if (violations==0) break;
+      }
+      
+      // Scan for violations in rest set
+      prof_phase(PH_KKT);
+      violations = 0;
+      scan_z_multi(z, &e2.mask, xMat, row_idx, col_idx, center, scale, &sumResid[0], r, n, p, K);
+      for (j = 0; j < p; j++) {
+        if (e2.has(j) == 0 && 
+            z_exceeds(&z[(size_t) j * K], &lev[0], m[col_idx[j]], &run[0], K, group)) {
+          e1.add(j);
+          e2.add(j);
+          violations++;
+        }
+      }
+      prof_violations(violations);
+      prof_phase(PH_SWEEP);
+      if (violations == 0) {
+        for (k = 0; k < K; k++) loss[k * L + l] = 0.0;
+        for (i = 0; i < n; i++) {
+          for (k = 0; k < K; k++) loss[k * L + l] += pow(r[(size_t) i * K + k], 2);
+        }
+        break;
+      }
+    }
+    for (k = 0; k < K; k++) {
+      if (run[k]) iter[k * L + l] = swept;
+    }
+    for (t = 0; t < e1.size(); t++) {
+      j = e1.idx[t];
+      for (k = 0; k < K; k++) {
+        if (run[k] && a[(size_t) j * K + k] != 0) beta((size_t) k * p + j, l) = a[(size_t) j * K + k];
+      }
+    }
+  }
+  
+  return List::create(beta, center, scale, lambda, loss, iter, n_reject, Rcpp::wrap(col_idx));
+}
+
+// Coordinate descent with sequential strong rule for multiple responses
+RcppExport SEXP cdfit_mgaussian_ssr(SEXP X_, SEXP y_, SEXP row_idx_, 
+                                    SEXP lambda_, SEXP nlambda_, 
+                                    SEXP lam_scale_, SEXP lambda_min_, 
+                                    SEXP alpha_, SEXP user_, SEXP eps_, 
+                                    SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
+                                    SEXP ncore_, SEXP group_, SEXP verbose_, SEXP io_) {
+  XPtr<BigMatrix> xMat(X_);
+  int n = Rf_length(row_idx_); // number of observations used for fitting model
+  int K = Rf_length(y_) / n;   // number of responses, y_ is n x K
+  vector<double> alpha(K, REAL(alpha_)[0]);
+  
+  // set up omp
+  int useCores = INTEGER(ncore_)[0];
+#ifdef BIGLASSO_OMP_H_
+  int haveCores = omp_get_num_procs();
+  if(useCores < 1) {
+    useCores = haveCores;
+  }
+  omp_set_dynamic(0);
+  omp_set_num_threads(useCores);
+#endif
+  
+  // responses row-major
+  WorkBuf<double> r((size_t) n * K);
+  for (int k = 0; k < K; k++) {
+    for (int i = 0; i < n; i++) r[(size_t) i * K + k] = REAL(y_)[(size_t) k * n + i];
+  }
+  IoOptions io(io_);
+  return cdfit_multi(xMat, r, INTEGER(row_idx_), alpha, lambda_, INTEGER(nlambda_)[0],
+                     INTEGER(lam_scale_)[0], REAL(lambda_min_)[0], INTEGER(user_)[0],
+                     REAL(eps_)[0], INTEGER(max_iter_)[0], REAL(multiplier_),
+                     INTEGER(dfmax_)[0], INTEGER(group_)[0], INTEGER(verbose_)[0], n, K);
+}
+
+// Coordinate descent with sequential strong rule for one response under
+// several values of alpha, standardized once
+RcppExport SEXP cdfit_gaussian_alphas(SEXP X_, SEXP y_, SEXP row_idx_, 
+                                      SEXP lambda_, SEXP nlambda_, 
+                                      SEXP lam_scale_, SEXP lambda_min_, 
+                                      SEXP alphas_, SEXP user_, SEXP eps_, 
+                                      SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
+                                      SEXP ncore_, SEXP verbose_, SEXP io_) {
+  XPtr<BigMatrix> xMat(X_);
+  int n = Rf_length(row_idx_); // number of observations used for fitting model
+  int K = Rf_length(alphas_);
+  vector<double> alpha(REAL(alphas_), REAL(alphas_) + K);
+  
+  // set up omp
+  int useCores = INTEGER(ncore_)[0];
+#ifdef BIGLASSO_OMP_H_
+  int haveCores = omp_get_num_procs();
+  if(useCores < 1) {
+    useCores = haveCores;
+  }
+  omp_set_dynamic(0);
+  omp_set_num_threads(useCores);
+#endif
+  
+  // one copy of the response per path, row-major
+  WorkBuf<double> r((size_t) n * K);
+  for (int i = 0; i < n; i++) {
+    for (int k = 0; k < K; k++) r[(size_t) i * K + k] = REAL(y_)[i];
+  }
+  IoOptions io(io_);
+  return cdfit_multi(xMat, r, INTEGER(row_idx_), alpha, lambda_, INTEGER(nlambda_)[0],
+                     INTEGER(lam_scale_)[0], REAL(lambda_min_)[0], INTEGER(user_)[0],
+                     REAL(eps_)[0], INTEGER(max_iter_)[0], REAL(multiplier_),
+                     INTEGER(dfmax_)[0], 0, INTEGER(verbose_)[0], n, K);
+}
@@ -0,0 +1,274 @@
+#include "utilities.h"
+
+// Native reader of delimited text files for setupX. The file is split into
+// byte ranges, one per task, each aligned to the start of a line; a first
+// pass counts the lines of every range so that each task knows the row its
+// range starts at, and a second pass parses the ranges in parallel, writing
+// the values straight into the file-backed big.matrix.
+//
+// The input is row-major and the matrix column-major, so writing each value
+// as it is parsed would touch a different page of the backing file per
+// field. Each task parses instead into a row-major tile of up to tile_rows
+// rows and then transposes it into the columns in blocks of TILE_COLS
+// columns, so every flush writes runs of tile_rows contiguous values per
+// column while reading the tile in cache-sized pieces.
+
+#ifdef _WIN32
+#define fseek64 _fseeki64
+#define ftell64 _ftelli64
+typedef __int64 off64;
+#else
+#define fseek64 fseeko
+#define ftell64 ftello
+typedef off_t off64;
+#endif
+
+#define CSV_CHUNK (8 << 20)
+#define TILE_COLS 64
+
+static const double pow10_exact[23] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// parse a number in [s, e). Decimal mantissas of at most 19 digits below
+// 2^53 with a power of ten up to 22 are exact in double arithmetic and are
+// converted directly; anything else goes through strtod, so the result is
+// always the correctly rounded value. Empty fields and "NA" give NA_REAL;
+// returns 0 if the field is not a number.
+static int parse_double(const char *s, const char *e, double *x) {
+  while (s < e && (*s == ' ' || *s == '"')) s++;
+  while (e > s && (e[-1] == ' ' || e[-1] == '"' || e[-1] == '\r')) e--;
+  if (s == e || (e - s == 2 && s[0] == 'N' && s[1] == 'A')) {
+    *x = NA_REAL;
+    return 1;
+  }
+  const char *p = s;
+  int neg = 0, nd = 0, ex = 0, ee = 0, eneg = 0;
+  uint64_t m = 0;
+  if (*p == '-' || *p == '+') neg = *p++ == '-';
+  for (; p < e && *p >= '0' && *p <= '9'; p++, nd++) m = m * 10 + (*p - '0');
+  if (p < e && *p == '.') {
+    for (p++; p < e && *p >= '0' && *p <= '9'; p++, nd++, ex--) m = m * 10 + (*p - '0');
+  }
+  if (nd > 0 && p < e && (*p == 'e' || *p == 'E')) {
+    const char *q = p + 1;
+    if (q < e && (*q == '-' || *q == '+')) eneg = *q++ == '-';
+    if (q < e && *q >= '0' && *q <= '9') {
+      for (; q < e && *q >= '0' && *q <= '9' && ee < 10000; q++) ee = ee * 10 + (*q - '0');
+      p = q;
+    }
+    ex += eneg ? -ee : ee;
+  }
+  if (nd > 0 && nd <= 19 && p == e && m < ((uint64_t) 1 << 53) && ex >= -22 && ex <= 22) {
+    double v = (double) m;
+    v = ex < 0 ? v / pow10_exact[-ex] : v * pow10_exact[ex];
+    *x = neg ? -v : v;
+    return 1;
+  }
+  // long mantissas, large exponents, inf and nan
+  char tmp[128], *end;
+  if (e - s >= (long) sizeof(tmp)) return 0;
+  memcpy(tmp, s, e - s);
+  tmp[e - s] = '\0';
+  *x = strtod(tmp, &end);
+  return *end == '\0';
+}
+
+// write the first nt rows of the row-major tile into rows row0.. of xAcc
+static void tile_flush(vector<double> &tile, int nt, int ncol, long row0,
+                       MatrixAccessor<double> *xAcc) {
+  for (int jb = 0; jb < ncol; jb += TILE_COLS) {
+    int je = jb + TILE_COLS < ncol ? jb + TILE_COLS : ncol;
+    for (int j = jb; j < je; j++) {
+      double *dst = (*xAcc)[j] + row0;
+      const double *src = &tile[j];
+      for (int i = 0; i < nt; i++) dst[i] = src[(size_t) i * ncol];
+    }
+  }
+}
+
+// Visit the lines in the byte range [b, e) of f, which starts at a line
+// start. Lines with nothing but a carriage return are skipped. If xAcc is
+// NULL the lines are only counted; otherwise line k is parsed into row
+// row0 + k of xAcc, through a tile of tile_rows rows. Lines whose number of
+// fields is not ncol, or that hold a field which is not a number, are read as
+// NA and counted in *bad.
+static long csv_range(FILE *f, off64 b, off64 e, char sep, int ncol, long row0,
+                      MatrixAccessor<double> *xAcc, int tile_rows, long *bad) {
+  size_t cap = CSV_CHUNK, carry = 0, got, want, len, start;
+  vector<char> buf(cap + 1); // one spare byte for a missing final newline
+  long lines = 0, tile0 = 0;
+  vector<double> tile(xAcc != NULL ? (size_t) tile_rows * ncol : 0);
+  off64 pos = b;
+  fseek64(f, b, SEEK_SET);
+  for (;;) {
+    want = cap - carry;
+    if ((off64) want > e - pos) want = e - pos;
+    got = want > 0 ? fread(&buf[carry], 1, want, f) : 0;
+    pos += got;
+    len = carry + got;
+    int done = pos >= e || got < want;
+    if (done && len > 0 && buf[len - 1] != '\n') buf[len++] = '\n';
+    
+    for (start = 0; ; ) {
+      char *nl = (char*) memchr(&buf[start], '\n', len - start);
+      if (nl == NULL) break;
+      const char *ls = &buf[start], *le = nl;
+      start = nl - &buf[0] + 1;
+      if (le > ls && le[-1] == '\r') le--;
+      if (le == ls) continue;
+      if (xAcc != NULL) {
+        double *row = &tile[(size_t) (lines - tile0) * ncol];
+        int j = 0, ok = 1;
+        for (const char *c = ls, *fs = ls; ok; c++) {
+          if (c == le || *c == sep) {
+            if (j >= ncol || !parse_double(fs, c, &row[j])) ok = 0;
+            j++;
+            fs = c + 1;
+            if (c == le) break;
+          }
+        }
+        if (!ok || j != ncol) {
+          for (j = 0; j < ncol; j++) row[j] = NA_REAL;
+          (*bad)++;
+        }
+        if (lines + 1 - tile0 == tile_rows) {
+          tile_flush(tile, tile_rows, ncol, row0 + tile0, xAcc);
+          tile0 = lines + 1;
+        }
+      }
+      lines++;
+    }
+    if (done) break;
+    carry = len - start;
+    memmove(&buf[0], &buf[start], carry);
+    if (carry == cap) { // a line longer than the buffer
+      cap *= 2;
+      buf.resize(cap + 1);
+    }
+  }
+  if (xAcc != NULL && lines > tile0) tile_flush(tile, lines - tile0, ncol, row0 + tile0, xAcc);
+  return lines;
+}
+
+// split [b, size) into nr ranges that start at line starts
+static vector<off64> csv_split(FILE *f, off64 b, off64 size, int nr) {
+  vector<off64> cut(nr + 1);
+  cut[0] = b;
+  cut[nr] = size;
+  for (int k = 1; k < nr; k++) {
+    off64 c = b + (size - b) / nr * k;
+    if (c <= cut[k - 1]) c = cut[k - 1] + 1;
+    fseek64(f, c - 1, SEEK_SET);
+    int ch;
+    while ((ch = fgetc(f)) != EOF && ch != '\n') c++;
+    cut[k] = c < size ? c : size;
+  }
+  return cut;
+}
+
+// open the file, skip the header line if any, and split the rest into ranges
+// of about CSV_CHUNK bytes; returns NULL if the file cannot be opened
+static FILE *csv_open(const char *fn, int header, int ncore, vector<off64> &cut) {
+  FILE *f = fopen(fn, "rb");
+  if (f == NULL) return NULL;
+  fseek64(f, 0, SEEK_END);
+  off64 size = ftell64(f), b = 0;
+  fseek64(f, 0, SEEK_SET);
+  if (header) {
+    int ch;
+    while ((ch = fgetc(f)) != EOF && ch != '\n') b++;
+    b = b + 1 < size ? b + 1 : size;
+  }
+  int nr = (size - b) / CSV_CHUNK + 1;
+  if (nr < ncore) nr = ncore;
+  if (nr > size - b) nr = size - b > 0 ? size - b : 1;
+  cut = csv_split(f, b, size, nr);
+  return f;
+}
+
+// number of lines in each range, counted in parallel
+static vector<long> csv_count(const char *fn, vector<off64> &cut, char sep) {
+  int k, nr = cut.size() - 1;
+  vector<long> lines(nr + 1, 0);
+#pragma omp parallel for private(k) schedule(dynamic)
+  for (k = 0; k < nr; k++) {
+    FILE *f = fopen(fn, "rb");
+    if (f != NULL) {
+      lines[k + 1] = csv_range(f, cut[k], cut[k + 1], sep, 0, 0, NULL, 0, NULL);
+      fclose(f);
+    }
+  }
+  for (k = 0; k < nr; k++) lines[k + 1] += lines[k]; // first row of each range
+  return lines;
+}
+
+// number of rows and columns of a delimited file; -1 if it cannot be read
+RcppExport SEXP csv_dims(SEXP filename_, SEXP sep_, SEXP header_, SEXP ncore_) {
+  const char *fn = CHAR(STRING_ELT(filename_, 0));
+  char sep = CHAR(STRING_ELT(sep_, 0))[0];
+  omp_set_num_threads(INTEGER(ncore_)[0]);
+  NumericVector res(2);
+  res[0] = res[1] = -1;
+
+  vector<off64> cut;
+  FILE *f = csv_open(fn, INTEGER(header_)[0], INTEGER(ncore_)[0], cut);
+  if (f == NULL) return res;
+  // the number of fields of the first line
+  fseek64(f, cut[0], SEEK_SET);
+  int ch, ncol = 1, any = 0;
+  while ((ch = fgetc(f)) != EOF && ch != '\n') {
+    if (ch == sep) ncol++;
+    if (ch != '\r') any = 1;
+  }
+  fclose(f);
+
+  vector<long> lines = csv_count(fn, cut, sep);
+  res[0] = lines.back();
+  res[1] = any ? ncol : 0;
+  return res;
+}
+
+// parse a delimited file into the big.matrix X of matching dimensions, with
+// at most budget_ MB of tiles in flight; returns the number of malformed
+// lines, whose rows are set to NA, or -1 if the file cannot be read
+RcppExport SEXP csv_fill(SEXP xP_, SEXP filename_, SEXP sep_, SEXP header_,
+                         SEXP budget_, SEXP ncore_) {
+  XPtr<BigMatrix> xpMat(xP_);
+  MatrixAccessor<double> xAcc(*xpMat);
+  const char *fn = CHAR(STRING_ELT(filename_, 0));
+  char sep = CHAR(STRING_ELT(sep_, 0))[0];
+  int ncol = xpMat->ncol();
+  omp_set_num_threads(INTEGER(ncore_)[0]);
+  NumericVector res(1);
+  res[0] = -1;
+
+  vector<off64> cut;
+  FILE *f = csv_open(fn, INTEGER(header_)[0], INTEGER(ncore_)[0], cut);
+  if (f == NULL) return res;
+  fclose(f);
+  vector<long> lines = csv_count(fn, cut, sep);
+  if (lines.back() != xpMat->nrow()) return res;
+
+  int k, nr = cut.size() - 1;
+  long bad = 0, bad_k;
+  double rows = REAL(budget_)[0] * 1048576 / INTEGER(ncore_)[0] / (ncol * sizeof(double));
+  int tile_rows = rows < 1 ? 1 : (rows > 65536 ? 65536 : (int) rows);
+#pragma omp parallel for private(k, bad_k) reduction(+:bad) schedule(dynamic)
+  for (k = 0; k < nr; k++) {
+    FILE *fk = fopen(fn, "rb");
+    bad_k = 0;
+    if (fk != NULL) {
+      long nk = lines[k + 1] - lines[k];
+      csv_range(fk, cut[k], cut[k + 1], sep, ncol, lines[k], &xAcc,
+                nk < tile_rows ? (nk > 0 ? nk : 1) : tile_rows, &bad_k);
+      fclose(fk);
+    } else {
+      bad_k = lines[k + 1] - lines[k];
+    }
+    bad += bad_k;
+  }
+  res[0] = bad;
+  return res;
+}
@@ -9,33 +9,40 @@ extern SEXP cdfit_cox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_idx_,
                       SEXP lambda_, SEXP nlambda_, SEXP lam_scale_,
                       SEXP lambda_min_, SEXP alpha_, SEXP user_, SEXP eps_, 
                       SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
-                      SEXP ncore_, SEXP warn_, SEXP verbose_);
+                      SEXP ncore_, SEXP warn_, SEXP verbose_, SEXP io_);
 
 extern SEXP cdfit_cox_ssr(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_idx_, 
                           SEXP lambda_, SEXP nlambda_, SEXP lam_scale_,
                           SEXP lambda_min_, SEXP alpha_, SEXP user_, SEXP eps_, 
                           SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
-                          SEXP ncore_, SEXP warn_, SEXP verbose_);
+                          SEXP ncore_, SEXP warn_, SEXP verbose_, SEXP io_);
 
 extern SEXP cdfit_cox_scox(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_idx_, 
                                SEXP lambda_, SEXP nlambda_, SEXP lam_scale_,
                                SEXP lambda_min_, SEXP alpha_, SEXP user_, SEXP eps_, 
                                SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
-                               SEXP ncore_, SEXP warn_, SEXP safe_thresh_, SEXP verbose_);
+                               SEXP ncore_, SEXP warn_, SEXP safe_thresh_, SEXP verbose_, SEXP io_);
+
+extern SEXP cdfit_cox_ws(SEXP X_, SEXP y_, SEXP d_, SEXP d_idx_, SEXP row_idx_, 
+                         SEXP lambda_, SEXP nlambda_, SEXP lam_scale_,
+                         SEXP lambda_min_, SEXP alpha_, SEXP user_, SEXP eps_, 
+                         SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
+                         SEXP ncore_, SEXP warn_, SEXP verbose_, SEXP io_);
 
 // Coordinate descent for logistic models
 extern SEXP cdfit_binomial_ssr(SEXP X_, SEXP y_, SEXP row_idx_, 
                                SEXP lambda_, SEXP nlambda_, SEXP lam_scale_,
                                SEXP lambda_min_, SEXP alpha_, SEXP user_, SEXP eps_, 
                                SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
-                               SEXP ncore_, SEXP warn_, SEXP verbose_);
+                               SEXP ncore_, SEXP warn_, SEXP accel_, SEXP gap_stop_,
+                               SEXP order_, SEXP verbose_, SEXP io_);
 
 extern SEXP cdfit_binomial_ssr_approx(SEXP X_, SEXP y_, SEXP row_idx_, 
                                       SEXP lambda_, SEXP nlambda_,
                                       SEXP lambda_min_, SEXP alpha_, 
                                       SEXP user_, SEXP eps_, 
                                       SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
-                                      SEXP ncore_, SEXP warn_, SEXP verbose_);
+                                      SEXP ncore_, SEXP warn_, SEXP verbose_, SEXP io_);
 
 extern SEXP cdfit_binomial_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEXP ylab_, 
                                       SEXP row_idx_, SEXP lambda_, SEXP nlambda_,
@@ -43,7 +50,7 @@ extern SEXP cdfit_binomial_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEXP ylab_,
                                       SEXP alpha_, SEXP user_, 
                                       SEXP eps_, SEXP max_iter_, SEXP multiplier_, 
                                       SEXP dfmax_, SEXP ncore_, SEXP warn_,
-                                      SEXP safe_thresh_, SEXP verbose_);
+                                      SEXP safe_thresh_, SEXP verbose_, SEXP io_);
 
 extern SEXP cdfit_binomial_ada_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEXP ylab_, 
                                           SEXP row_idx_, SEXP lambda_, SEXP nlambda_,
@@ -51,7 +58,13 @@ extern SEXP cdfit_binomial_ada_slores_ssr(SEXP X_, SEXP y_, SEXP n_pos_, SEXP yl
                                           SEXP alpha_, SEXP user_, 
                                           SEXP eps_, SEXP max_iter_, SEXP multiplier_, 
                                           SEXP dfmax_, SEXP ncore_, SEXP warn_,
-                                          SEXP safe_thresh_, SEXP update_thresh_, SEXP verbose_);
+                                          SEXP safe_thresh_, SEXP update_thresh_, SEXP verbose_, SEXP io_);
+
+extern SEXP cdfit_binomial_ws(SEXP X_, SEXP y_, SEXP row_idx_, 
+                              SEXP lambda_, SEXP nlambda_, SEXP lam_scale_,
+                              SEXP lambda_min_, SEXP alpha_, SEXP user_, SEXP eps_, 
+                              SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
+                              SEXP ncore_, SEXP warn_, SEXP verbose_, SEXP io_);
 
 // Coordinate descent for gaussian models
 extern SEXP cdfit_gaussian_ada_edpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_, SEXP lambda_, 
@@ -59,14 +72,15 @@ extern SEXP cdfit_gaussian_ada_edpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_, SEXP la
                                         SEXP lambda_min_, SEXP alpha_, 
                                         SEXP user_, SEXP eps_, SEXP max_iter_, 
                                         SEXP multiplier_, SEXP dfmax_, SEXP ncore_,
-                                        SEXP update_thresh_, SEXP verbose_);
+                                        SEXP update_thresh_, SEXP verbose_, SEXP io_);
 
 extern SEXP cdfit_gaussian_ssr(SEXP X_, SEXP y_, SEXP row_idx_, 
                                SEXP lambda_, SEXP nlambda_, 
                                SEXP lam_scale_, SEXP lambda_min_, 
                                SEXP alpha_, SEXP user_, SEXP eps_, 
                                SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
-                               SEXP ncore_, SEXP verbose_);
+                               SEXP ncore_, SEXP accel_, SEXP gap_stop_, 
+                               SEXP order_, SEXP verbose_, SEXP io_);
 
 extern SEXP cdfit_gaussian_bedpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_,  
                                      SEXP lambda_, SEXP nlambda_,
@@ -76,21 +90,75 @@ extern SEXP cdfit_gaussian_bedpp_ssr(SEXP X_, SEXP y_, SEXP row_idx_,
                                      SEXP max_iter_, SEXP multiplier_, 
                                      SEXP dfmax_, SEXP ncore_, 
                                      SEXP safe_thresh_,
-                                     SEXP verbose_);
+                                     SEXP verbose_, SEXP io_);
+
+extern SEXP cdfit_gaussian_ws(SEXP X_, SEXP y_, SEXP row_idx_, 
+                              SEXP lambda_, SEXP nlambda_, 
+                              SEXP lam_scale_, SEXP lambda_min_, 
+                              SEXP alpha_, SEXP user_, SEXP eps_, 
+                              SEXP max_iter_, SEXP multiplier_, SEXP dfmax_, 
+                              SEXP ncore_, SEXP verbose_, SEXP io_);
+
+extern SEXP cdfit_mgaussian_ssr(SEXP X_, SEXP y_, SEXP row_idx_, SEXP lambda_, SEXP nlambda_,
+                                SEXP lam_scale_, SEXP lambda_min_, SEXP alpha_, SEXP user_,
+                                SEXP eps_, SEXP max_iter_, SEXP multiplier_, SEXP dfmax_,
+                                SEXP ncore_, SEXP group_, SEXP verbose_, SEXP io_);
+
+extern SEXP cdfit_gaussian_alphas(SEXP X_, SEXP y_, SEXP row_idx_, SEXP lambda_, SEXP nlambda_,
+                                  SEXP lam_scale_, SEXP lambda_min_, SEXP alphas_, SEXP user_,
+                                  SEXP eps_, SEXP max_iter_, SEXP multiplier_, SEXP dfmax_,
+                                  SEXP ncore_, SEXP verbose_, SEXP io_);
+
+// Native cross-validation
+extern SEXP cvfit_native(SEXP X_, SEXP y_, SEXP row_idx_, SEXP fold_, SEXP nfolds_,
+                         SEXP family_, SEXP lambda_, SEXP alpha_, SEXP eps_,
+                         SEXP max_iter_, SEXP multiplier_, SEXP dfmax_,
+                         SEXP beta_i_, SEXP beta_p_, SEXP beta_x_,
+                         SEXP metric_, SEXP stop_rise_, SEXP ncore_);
+extern SEXP stability_native(SEXP X_, SEXP y_, SEXP row_idx_, SEXP idx_,
+                             SEXP family_, SEXP lambda_, SEXP alpha_, SEXP eps_,
+                             SEXP max_iter_, SEXP multiplier_, SEXP dfmax_,
+                             SEXP beta_i_, SEXP beta_p_, SEXP beta_x_, SEXP ncore_);
+
+// Compressed column sidecar for file-backed matrices
+extern SEXP compress_columns(SEXP xP_, SEXP path_, SEXP ncore_);
+
+// Per-phase counters of the last fit
+extern SEXP get_profile();
+
+// Frees the buffers kept by the workspace
+extern SEXP release_workspace();
+
+// Native reader of delimited files
+extern SEXP csv_dims(SEXP filename_, SEXP sep_, SEXP header_, SEXP ncore_);
+extern SEXP csv_fill(SEXP xP_, SEXP filename_, SEXP sep_, SEXP header_,
+                     SEXP budget_, SEXP ncore_);
 
 extern SEXP _biglasso_get_eta(SEXP xPSEXP, SEXP row_idx_SEXP, SEXP betaSEXP, SEXP idx_pSEXP, SEXP idx_lSEXP);
 
 static R_CallMethodDef callMethods[] = {
-  {"cdfit_cox", (DL_FUNC) &cdfit_cox, 18},
-  {"cdfit_cox_ssr", (DL_FUNC) &cdfit_cox_ssr, 18},
-  {"cdfit_cox_scox", (DL_FUNC) &cdfit_cox_scox, 19},
-  {"cdfit_binomial_ssr", (DL_FUNC) &cdfit_binomial_ssr, 16},
-  {"cdfit_binomial_ssr_approx", (DL_FUNC) &cdfit_binomial_ssr_approx, 15},
-  {"cdfit_binomial_slores_ssr", (DL_FUNC) &cdfit_binomial_slores_ssr, 19},
-  {"cdfit_binomial_ada_slores_ssr", (DL_FUNC) &cdfit_binomial_ada_slores_ssr, 20},
-  {"cdfit_gaussian_ada_edpp_ssr", (DL_FUNC) &cdfit_gaussian_ada_edpp_ssr, 16},
-  {"cdfit_gaussian_ssr", (DL_FUNC) &cdfit_gaussian_ssr, 15},
-  {"cdfit_gaussian_bedpp_ssr", (DL_FUNC) &cdfit_gaussian_bedpp_ssr, 16},
+  {"cdfit_cox", (DL_FUNC) &cdfit_cox, 19},
+  {"cdfit_cox_ssr", (DL_FUNC) &cdfit_cox_ssr, 19},
+  {"cdfit_cox_scox", (DL_FUNC) &cdfit_cox_scox, 20},
+  {"cdfit_cox_ws", (DL_FUNC) &cdfit_cox_ws, 19},
+  {"cdfit_binomial_ssr", (DL_FUNC) &cdfit_binomial_ssr, 20},
+  {"cdfit_binomial_ssr_approx", (DL_FUNC) &cdfit_binomial_ssr_approx, 16},
+  {"cdfit_binomial_slores_ssr", (DL_FUNC) &cdfit_binomial_slores_ssr, 20},
+  {"cdfit_binomial_ada_slores_ssr", (DL_FUNC) &cdfit_binomial_ada_slores_ssr, 21},
+  {"cdfit_binomial_ws", (DL_FUNC) &cdfit_binomial_ws, 17},
+  {"cdfit_gaussian_ada_edpp_ssr", (DL_FUNC) &cdfit_gaussian_ada_edpp_ssr, 17},
+  {"cdfit_gaussian_ssr", (DL_FUNC) &cdfit_gaussian_ssr, 19},
+  {"cdfit_gaussian_bedpp_ssr", (DL_FUNC) &cdfit_gaussian_bedpp_ssr, 17},
+  {"cdfit_gaussian_ws", (DL_FUNC) &cdfit_gaussian_ws, 16},
+  {"cdfit_mgaussian_ssr", (DL_FUNC) &cdfit_mgaussian_ssr, 17},
+  {"cdfit_gaussian_alphas", (DL_FUNC) &cdfit_gaussian_alphas, 16},
+  {"cvfit_native", (DL_FUNC) &cvfit_native, 18},
+  {"stability_native", (DL_FUNC) &stability_native, 15},
+  {"compress_columns", (DL_FUNC) &compress_columns, 3},
+  {"get_profile", (DL_FUNC) &get_profile, 0},
+  {"release_workspace", (DL_FUNC) &release_workspace, 0},
+  {"csv_dims", (DL_FUNC) &csv_dims, 4},
+  {"csv_fill", (DL_FUNC) &csv_fill, 6},
   {"_biglasso_get_eta", (DL_FUNC) &_biglasso_get_eta, 5},
   {NULL, NULL, 0}
 };
@@ -99,3 +167,7 @@ void R_init_biglasso(DllInfo *dll) {
   R_registerRoutines(dll,NULL,callMethods,NULL,NULL);
   R_useDynamicSymbols(dll, FALSE);
 }
+
+void R_unload_biglasso(DllInfo *dll) {
+  release_workspace();
+}
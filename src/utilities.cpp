@@ -8,6 +8,16 @@
 // #include <stdlib.h>
 
 #include "utilities.h"
+#include <map>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 double sign(double x) {
   if(x > 0.00000000001) return 1.0;
@@ -41,12 +51,71 @@ int sum(int *x, int n) {
 //   return result;
 // }
 
-double sum(double *x, int n) {
-  double sum = 0;
-  for (int i = 0; i < n; i++) {
-    sum += x[i];
+// Deterministic reductions over n, for the one-shot sums (the loss, the
+// duality gap). The terms are cut into blocks of DET_BLOCK at fixed
+// positions; the blocks are summed left to right, in parallel once n reaches
+// DET_PARALLEL, and the block sums are added pairwise in a fixed tree. The
+// result depends on n only, never on the number of threads or on which
+// thread summed which block, so a fit is bitwise the same for every ncores.
+// Up to DET_BLOCK terms this is the plain loop.
+// Only a call from outside any parallel region opens a team, of the fit's
+// ncores threads (set by omp_set_num_threads); called from a thread of a
+// parallel region, e.g. a fold of cvfit_native, the blocks are summed by
+// that thread alone, so that the folds do not each start a team of their own.
+#define DET_BLOCK 2048
+#define DET_PARALLEL (1 << 16)
+#define DET_CHUNK 1024 // blocks summed by the team at a time
+
+// adds the sum of block b to the tree kept on stk: the pending sums of
+// 2^level blocks, of decreasing level from the bottom
+static inline void det_push(double *stk, int &top, long b, double s) {
+  stk[top++] = s;
+  for (long c = b + 1; !(c & 1); c >>= 1) {
+    top--;
+    stk[top - 1] += stk[top];
+  }
+}
+
+template<typename F>
+static double det_reduce(long n, F term) {
+  long nb = (n + DET_BLOCK - 1) / DET_BLOCK, b, b0, b1;
+  if (nb <= 1) {
+    double s = 0.0;
+    for (long i = 0; i < n; i++) s += term(i);
+    return s;
+  }
+  double stk[64], part[DET_CHUNK];
+  int top = 0, nt = omp_get_max_threads();
+  for (b0 = 0; b0 < nb; b0 += DET_CHUNK) {
+    b1 = b0 + DET_CHUNK < nb ? b0 + DET_CHUNK : nb;
+#pragma omp parallel for num_threads(nt) if(n >= DET_PARALLEL && !omp_in_parallel()) schedule(static)
+    for (b = b0; b < b1; b++) {
+      long i1 = (b + 1) * DET_BLOCK < n ? (b + 1) * DET_BLOCK : n;
+      double s = 0.0;
+      for (long i = b * DET_BLOCK; i < i1; i++) s += term(i);
+      part[b - b0] = s;
+    }
+    for (b = b0; b < b1; b++) det_push(stk, top, b, part[b - b0]);
   }
-  return(sum);
+  for (; top > 1; top--) stk[top - 2] += stk[top - 1];
+  return stk[0];
+}
+
+double det_sum(double *x, long n) {
+  return det_reduce(n, [=](long i) { return x[i]; });
+}
+
+double det_dot(double *x, double *y, long n) {
+  return det_reduce(n, [=](long i) { return x[i] * y[i]; });
+}
+
+// plain loop: called after every coordinate update, where a team or a
+// blocked sum would cost more than the sum; serial, so it is the same for
+// every ncores
+double sum(double *x, int n) {
+  double s = 0.0;
+  for (int i = 0; i < n; i++) s += x[i];
+  return s;
 }
 
 // Sum of squares of jth column of X
@@ -67,9 +136,7 @@ double lasso(double z, double l1, double l2, double v) {
 
 // Gaussian loss
 double gLoss(double *r, int n) {
-  double l = 0;
-  for (int i=0;i<n;i++) l = l + pow(r[i],2);
-  return(l);
+  return det_dot(r, r, n);
 }
 
 // get X[i, j]: i-th row, j-th column element
@@ -98,6 +165,7 @@ double crossprod_bm(XPtr<BigMatrix> xpMat, double *y_, int *row_idx_, double cen
   double sum = 0.0;
   double sum_xy = 0.0;
   double sum_y = 0.0;
+  prof_reads(1);
   for (int i=0; i < n_row; i++) {
     sum_xy = sum_xy + xCol[row_idx_[i]] * y_[i];
     sum_y = sum_y + y_[i];
@@ -116,6 +184,7 @@ double crossprod_bm_Xj_Xk(XPtr<BigMatrix> xMat, int *row_idx,
   double *xCol_k = xAcc[k];
   double sum_xj_xk = 0.0;
   double res = 0.0;
+  prof_reads(2);
   
   for (int i = 0; i < n; i++) {
     sum_xj_xk += xCol_j[row_idx[i]] * xCol_k[row_idx[i]];
@@ -125,11 +194,51 @@ double crossprod_bm_Xj_Xk(XPtr<BigMatrix> xMat, int *row_idx,
   return res;
 }
 
+// crossprod of every feature with column xmax_idx, both standardized.
+// Rows are taken in blocks so that the block of x_max stays in cache while
+// all columns stream past it in parallel.
+void crossprod_xmax(double *xtx, XPtr<BigMatrix> xpMat, int xmax_idx, int *row_idx,
+                    vector<int> &col_idx, NumericVector &center, NumericVector &scale,
+                    int n, int p) {
+  MatrixAccessor<double> xAcc(*xpMat);
+  double *xCol, *xCol_max = xAcc[xmax_idx];
+  WorkBuf<double> xmax(n);
+  double sum;
+  int i, j, c, nb, i0, i1, blk = 4096;
+  for (i = 0; i < n; i++) xmax[i] = xCol_max[row_idx[i]];
+  for (j = 0; j < p; j++) xtx[j] = 0.0;
+  prof_reads(p + 1);
+  
+  ColumnStream cs(xpMat, col_idx, NULL, p);
+  while (cs.next()) {
+    nb = cs.size();
+    for (i0 = 0; i0 < n; i0 += blk) {
+      i1 = i0 + blk < n ? i0 + blk : n;
+#pragma omp parallel for private(i, j, c, xCol, sum) schedule(static)
+      for (c = 0; c < nb; c++) {
+        j = cs.col(c);
+        xCol = cs.data(c);
+        sum = 0.0;
+        for (i = i0; i < i1; i++) {
+          sum = sum + xCol[row_idx[i]] * xmax[i];
+        }
+        xtx[j] += sum;
+      }
+    }
+  }
+  for (j = 0; j < p; j++) {
+    int jj = col_idx[j];
+    xtx[j] = (xtx[j] - n * center[jj] * center[xmax_idx]) / (scale[jj] * scale[xmax_idx]);
+  }
+  
+}
+
 //crossprod_resid - given specific rows of X: separate computation
 double crossprod_resid(XPtr<BigMatrix> xpMat, double *y_, double sumY_, int *row_idx_, 
                        double center_, double scale_, int n_row, int j) {
   MatrixAccessor<double> xAcc(*xpMat);
   double *xCol = xAcc[j];
+  prof_reads(1);
   
   double sum = 0.0;
   for (int i=0; i < n_row; i++) {
@@ -144,6 +253,7 @@ void update_resid(XPtr<BigMatrix> xpMat, double *r, double shift, int *row_idx_,
                   double center_, double scale_, int n_row, int j) {
   MatrixAccessor<double> xAcc(*xpMat);
   double *xCol = xAcc[j];
+  prof_reads(1);
   for (int i=0; i < n_row; i++) {
     r[i] -= shift * (xCol[row_idx_[i]] - center_) / scale_;
   }
@@ -156,6 +266,7 @@ void update_resid_eta(double *r, double *eta, XPtr<BigMatrix> xpMat, double shif
   MatrixAccessor<double> xAcc(*xpMat);
   double *xCol = xAcc[j];
   double si; 
+  prof_reads(1);
   for (int i=0;i<n;i++) {
     si = shift * (xCol[row_idx_[i]] - center_) / scale_;
     r[i] -= si;
@@ -180,9 +291,7 @@ double sqsum_bm(SEXP xP, int n_row, int j, int useCores) {
 // Weighted sum of residuals
 double wsum(double *r, double *w, int n_row) {
   double val = 0.0;
-  for (int i = 0; i < n_row; i++) {
-    val += r[i] * w[i];
-  }
+  for (int i = 0; i < n_row; i++) val += r[i] * w[i];
   return val;
 }
 
@@ -191,6 +300,7 @@ double wcrossprod_resid(XPtr<BigMatrix> xpMat, double *y, double sumYW_, int *ro
                         double center_, double scale_, double *w, int n_row, int j) {
   MatrixAccessor<double> xAcc(*xpMat);
   double *xCol = xAcc[j];
+  prof_reads(1);
   
   double val = 0.0;
   for (int i = 0; i < n_row; i++) {
@@ -208,6 +318,7 @@ double wsqsum_bm(XPtr<BigMatrix> xpMat, double *w, int *row_idx_, double center_
                  double scale_, int n_row, int j) {
   MatrixAccessor<double> xAcc(*xpMat);
   double *xCol = xAcc[j];
+  prof_reads(1);
   
   double val = 0.0;
   double sum_wx_sq = 0.0;
@@ -223,36 +334,52 @@ double wsqsum_bm(XPtr<BigMatrix> xpMat, double *w, int *row_idx_, double center_
 }
 
 // standardize
+// Column moments and X'y come from one parallel pass over the columns, read
+// through a ColumnStream; the kept set and x_max are then picked serially so
+// col_idx keeps its order.
 void standardize_and_get_residual(NumericVector &center, NumericVector &scale, 
                                   int *p_keep_ptr, vector<int> &col_idx, //columns to keep, removing columns whose scale < 1e-6
                                   vector<double> &z, double *lambda_max_ptr,
                                   int *xmax_ptr, XPtr<BigMatrix> xMat, double *y, 
                                   int *row_idx, double lambda_min, double alpha, int n, int p) {
-  MatrixAccessor<double> xAcc(*xMat);
   double *xCol;
-  double sum_xy, sum_y;
+  double sum_y = 0.0;
   double zmax = 0.0, zj = 0.0;
-  int i, j;
+  vector<double> sum_xy(p);
+  int i, j, k, nb;
   
-  for (j = 0; j < p; j++) {
-    xCol = xAcc[j];
-    sum_xy = 0.0;
-    sum_y = 0.0;
-    
-    for (i = 0; i < n; i++) {
-      center[j] += xCol[row_idx[i]];
-      scale[j] += pow(xCol[row_idx[i]], 2);
+  for (i = 0; i < n; i++) {
+    sum_y = sum_y + y[i];
+  }
+  
+  vector<int> all(p);
+  for (j = 0; j < p; j++) all[j] = j;
+  ColumnStream cs(xMat, all, NULL, p);
+  prof_reads(p);
+  while (cs.next()) {
+    nb = cs.size();
+#pragma omp parallel for private(i, j, k, xCol) schedule(static)
+    for (k = 0; k < nb; k++) {
+      j = cs.col(k);
+      xCol = cs.data(k);
+      sum_xy[j] = 0.0;
+      
+      for (i = 0; i < n; i++) {
+        center[j] += xCol[row_idx[i]];
+        scale[j] += pow(xCol[row_idx[i]], 2);
+        
+        sum_xy[j] = sum_xy[j] + xCol[row_idx[i]] * y[i];
+      }
       
-      sum_xy = sum_xy + xCol[row_idx[i]] * y[i];
-      sum_y = sum_y + y[i];
+      center[j] = center[j] / n; //center
+      scale[j] = sqrt(scale[j] / n - pow(center[j], 2)); //scale
     }
-    
-    center[j] = center[j] / n; //center
-    scale[j] = sqrt(scale[j] / n - pow(center[j], 2)); //scale
-    
+  }
+  
+  for (j = 0; j < p; j++) {
     if (scale[j] > 1e-6) {
       col_idx.push_back(j);
-      zj = (sum_xy - center[j] * sum_y) / (scale[j] * n); //residual
+      zj = (sum_xy[j] - center[j] * sum_y) / (scale[j] * n); //residual
       if (fabs(zj) > zmax) {
         zmax = fabs(zj);
         *xmax_ptr = j; // xmax_ptr is the index in the raw xMat, not index in col_idx!
@@ -264,181 +391,914 @@ void standardize_and_get_residual(NumericVector &center, NumericVector &scale,
   *lambda_max_ptr = zmax / alpha;
 }
 
+Profile prof;
+
+ProfileFit::ProfileFit(int n, int L) {
+  prof.on = 1;
+  prof.n = n;
+  prof.L = L > 0 ? L : 1;
+  prof.l = 0;
+  prof.phase = PH_PREP;
+  prof.time.assign((size_t) prof.L * N_PHASE, 0.0);
+  prof.reads.assign((size_t) prof.L * N_PHASE, 0.0);
+  prof.sweeps.assign(prof.L, 0);
+  prof.violations.assign(prof.L, 0);
+  prof.t0 = std::chrono::steady_clock::now();
+}
+
+ProfileFit::~ProfileFit() {
+  prof_phase(PH_PREP);
+  prof.on = 0;
+}
+
+// charge the time since the last switch to the current phase, then switch;
+// returns the phase left
+int prof_phase(int phase) {
+  int prev = prof.phase;
+  if (!prof.on) return prev;
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  prof.time[prof.l + prof.L * prev] += std::chrono::duration<double>(now - prof.t0).count();
+  prof.t0 = now;
+  prof.phase = phase;
+  return prev;
+}
+
+void prof_lambda(int l) {
+  prof_phase(PH_SCREEN);
+  if (prof.on && l < prof.L) prof.l = l;
+}
+
+// profile of the last fit: time and reads as L x 5 matrices with the phases
+// preprocessing, screening, sweeps, KKT checks and safe-rule updates in
+// columns, the sweeps and KKT violations, and n
+RcppExport SEXP get_profile() {
+  int L = prof.L > 0 ? prof.L : 0;
+  NumericMatrix time(L, N_PHASE), reads(L, N_PHASE);
+  for (int k = 0; k < L * N_PHASE; k++) {
+    time[k] = prof.time[k];
+    reads[k] = prof.reads[k];
+  }
+  return List::create(time, reads, Rcpp::wrap(prof.sweeps),
+                      Rcpp::wrap(prof.violations), prof.n);
+}
+
+// I/O options for file-backed matrices, given to each fit as c(prefetch,
+// budget in MB, compressed) and in force for its duration only. With
+// prefetch on, a scan asks the kernel to read ahead the next block of columns
+// (MADV_WILLNEED) and releases the scanned pages at the end (MADV_DONTNEED).
+// With a positive budget, the columns are instead read with pread into two
+// buffers of budget / 2 bytes: a reader thread fills one while the compute
+// threads work on the other, so the matrix never goes through the page
+// cache mapping of the process.
+#define IO_BLOCK_BYTES (32 << 20)
+
+static int io_hints = 0;
+static double io_budget = 0.0; // bytes
+static int io_chunks = 0;
+
+IoOptions::IoOptions(SEXP io_) {
+  io_hints = REAL(io_)[0] != 0;
+  io_budget = REAL(io_)[1] * 1048576.0;
+  io_chunks = REAL(io_)[2] != 0;
+}
+
+IoOptions::~IoOptions() {
+  io_hints = 0;
+  io_budget = 0.0;
+  io_chunks = 0;
+}
+
+// Compressed column chunks. setupX(compress = TRUE) writes a sidecar file
+// "<backingfile>.bcc" next to the backing file, holding each column with the
+// smallest of three codecs:
+//   CHUNK_RAW   the doubles as they are;
+//   CHUNK_DICT  a dictionary of at most 256 distinct values (compared by bit
+//               pattern, so decoding is exact) and the codes packed 1, 2, 4
+//               or 8 bits each, e.g. 32x smaller for genotypes coded 0/1/2;
+//   CHUNK_DELTA for integer values below 2^53 in magnitude, the differences
+//               of consecutive values, zigzag-coded as LEB128 varints, e.g.
+//               1 or 2 bytes a value for sorted positions or counts.
+// Layout: 8-byte magic, nrow and ncol as int64, the stamp of the backing file
+// (size, inode, mtime in s and ns) as int64, ncol + 1 int64 byte offsets of
+// the columns, then the columns, each padded to 8 bytes and starting with a
+// ChunkHeader. Out-of-core scans read this file instead of the backing file
+// only when the fit asks for it (ooc.compressed = TRUE), and then only if its
+// shape and stamp match the backing file. A write through the memory mapping
+// need not change the stamp, so the stamp alone cannot prove the copy current.
+static const char CHUNK_MAGIC[8] = {'B', 'L', 'C', 'C', '0', '0', '0', '2'};
+enum { CHUNK_RAW = 0, CHUNK_DICT = 1, CHUNK_DELTA = 2 };
+#define CHUNK_STAMP 4
+#define CHUNK_TABLE (sizeof(CHUNK_MAGIC) + (2 + CHUNK_STAMP) * sizeof(int64_t))
+
+struct ChunkHeader {
+  uint8_t codec;
+  uint8_t bits;
+  uint16_t pad;
+  uint32_t k; // dictionary size
+};
+
+// the deltas of column x of length n as zigzag varints; returns 0 if a value
+// is not an integer below 2^53 in magnitude (or is -0), or if the varints
+// take as much room as the doubles
+static int delta_encode(double *x, long n, vector<uint8_t> &out) {
+  int64_t prev = 0, cur;
+  uint64_t z;
+  out.clear();
+  for (long i = 0; i < n; i++) {
+    if (!(fabs(x[i]) <= 9007199254740992.0) || x[i] != floor(x[i]) ||
+        (x[i] == 0 && std::signbit(x[i]))) {
+      return 0;
+    }
+    cur = (int64_t) x[i];
+    z = ((uint64_t) (cur - prev) << 1) ^ (uint64_t) ((cur - prev) >> 63);
+    prev = cur;
+    for (; z >= 0x80; z >>= 7) out.push_back((uint8_t) (z | 0x80));
+    out.push_back((uint8_t) z);
+    if (out.size() >= (size_t) n * sizeof(double)) return 0;
+  }
+  return 1;
+}
+
+// encode column x of length n into out
+static void encode_column(double *x, long n, vector<char> &out) {
+  vector<uint64_t> dict; // sorted bit patterns
+  vector<uint8_t> delta;
+  uint64_t v;
+  size_t pos;
+  long i;
+  for (i = 0; i < n; i++) {
+    memcpy(&v, &x[i], sizeof(double));
+    pos = lower_bound(dict.begin(), dict.end(), v) - dict.begin();
+    if (pos == dict.size() || dict[pos] != v) {
+      if (dict.size() == 256) break;
+      dict.insert(dict.begin() + pos, v);
+    }
+  }
+  ChunkHeader h = {CHUNK_RAW, 0, 0, 0};
+  size_t len = n * sizeof(double);
+  if (i == n) {
+    h.codec = CHUNK_DICT;
+    h.k = dict.size();
+    h.bits = h.k <= 2 ? 1 : (h.k <= 4 ? 2 : (h.k <= 16 ? 4 : 8));
+    len = h.k * sizeof(double) + (n * h.bits + 7) / 8;
+  }
+  if (delta_encode(x, n, delta) && delta.size() < len) {
+    h.codec = CHUNK_DELTA;
+    h.bits = h.k = 0;
+    len = delta.size();
+  }
+  out.assign((sizeof(h) + len + 7) / 8 * 8, 0);
+  memcpy(&out[0], &h, sizeof(h));
+  if (h.codec == CHUNK_RAW) {
+    memcpy(&out[sizeof(h)], x, n * sizeof(double));
+    return;
+  }
+  if (h.codec == CHUNK_DELTA) {
+    memcpy(&out[sizeof(h)], &delta[0], len);
+    return;
+  }
+  memcpy(&out[sizeof(h)], &dict[0], h.k * sizeof(double));
+  uint8_t *code = (uint8_t*) &out[sizeof(h) + h.k * sizeof(double)];
+  for (i = 0; i < n; i++) {
+    memcpy(&v, &x[i], sizeof(double));
+    pos = lower_bound(dict.begin(), dict.end(), v) - dict.begin();
+    code[i * h.bits / 8] |= pos << (i * h.bits % 8);
+  }
+}
+
+// decode a column of length n from src; returns 0 if src is not a valid chunk
+static int decode_column(const char *src, size_t len, double *x, long n) {
+  ChunkHeader h;
+  if (len < sizeof(h)) return 0;
+  memcpy(&h, src, sizeof(h));
+  if (h.codec == CHUNK_RAW) {
+    if (len < sizeof(h) + n * sizeof(double)) return 0;
+    memcpy(x, src + sizeof(h), n * sizeof(double));
+    return 1;
+  }
+  if (h.codec == CHUNK_DELTA) {
+    const uint8_t *c = (const uint8_t*) src + sizeof(h), *end = (const uint8_t*) src + len;
+    int64_t cur = 0;
+    for (long i = 0; i < n; i++) {
+      uint64_t z = 0;
+      int shift = 0;
+      do {
+        if (c == end || shift > 63) return 0;
+        z |= (uint64_t) (*c & 0x7f) << shift;
+        shift += 7;
+      } while (*c++ & 0x80);
+      cur += (int64_t) (z >> 1) ^ -(int64_t) (z & 1);
+      x[i] = (double) cur;
+    }
+    return 1;
+  }
+  if (h.codec != CHUNK_DICT || h.k == 0 || h.k > 256 || (h.bits != 1 && h.bits != 2 &&
+      h.bits != 4 && h.bits != 8) || len < sizeof(h) + h.k * sizeof(double) + (n * h.bits + 7) / 8) {
+    return 0;
+  }
+  double dict[256];
+  memcpy(dict, src + sizeof(h), h.k * sizeof(double));
+  const uint8_t *code = (const uint8_t*) src + sizeof(h) + h.k * sizeof(double);
+  unsigned int mask = (1u << h.bits) - 1, c;
+  for (long i = 0; i < n; i++) {
+    c = (code[i * h.bits / 8] >> (i * h.bits % 8)) & mask;
+    x[i] = dict[c < h.k ? c : 0];
+  }
+  return 1;
+}
+
+// stamp of the backing file of fb: size, inode, mtime in s and ns; returns 0
+// if it cannot be read
+static int backing_stamp(FileBackedBigMatrix *fb, int64_t *stamp) {
+#ifndef _WIN32
+  string path = fb->file_path();
+  if (path.size() > 0 && path[path.size() - 1] != '/') path += "/";
+  struct stat st;
+  if (stat((path + fb->file_name()).c_str(), &st) != 0) return 0;
+  stamp[0] = st.st_size;
+  stamp[1] = st.st_ino;
+#ifdef __APPLE__
+  stamp[2] = st.st_mtimespec.tv_sec;
+  stamp[3] = st.st_mtimespec.tv_nsec;
+#else
+  stamp[2] = st.st_mtim.tv_sec;
+  stamp[3] = st.st_mtim.tv_nsec;
+#endif
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+// write the compressed sidecar of a file-backed big.matrix, whose pages must
+// have been flushed; returns the raw and the compressed size in bytes, the
+// latter -1 if the file could not be written
+RcppExport SEXP compress_columns(SEXP xP_, SEXP path_, SEXP ncore_) {
+  XPtr<BigMatrix> xpMat(xP_);
+  MatrixAccessor<double> xAcc(*xpMat);
+  int64_t nrow = xpMat->nrow(), ncol = xpMat->ncol();
+  int b, j, nb = 256;
+  omp_set_num_threads(INTEGER(ncore_)[0]);
+  
+  NumericVector res(2);
+  res[0] = (double) nrow * ncol * sizeof(double);
+  res[1] = -1;
+  int64_t stamp[CHUNK_STAMP];
+  FileBackedBigMatrix *fb = dynamic_cast<FileBackedBigMatrix*>(xpMat.get());
+  if (fb == NULL || !backing_stamp(fb, stamp)) return res;
+  FILE *f = fopen(CHAR(STRING_ELT(path_, 0)), "wb");
+  if (f == NULL) return res;
+  vector<int64_t> off(ncol + 1);
+  off[0] = CHUNK_TABLE + (ncol + 1) * sizeof(int64_t);
+  fwrite(CHUNK_MAGIC, 1, sizeof(CHUNK_MAGIC), f);
+  fwrite(&nrow, sizeof(int64_t), 1, f);
+  fwrite(&ncol, sizeof(int64_t), 1, f);
+  fwrite(stamp, sizeof(int64_t), CHUNK_STAMP, f);
+  fwrite(&off[0], sizeof(int64_t), ncol + 1, f); // rewritten at the end
+  
+  vector< vector<char> > chunk(nb);
+  for (b = 0; b < ncol; b += nb) {
+    int m = ncol - b < nb ? ncol - b : nb;
+#pragma omp parallel for private(j) schedule(dynamic)
+    for (j = 0; j < m; j++) {
+      encode_column(xAcc[b + j], nrow, chunk[j]);
+    }
+    for (j = 0; j < m; j++) {
+      fwrite(&chunk[j][0], 1, chunk[j].size(), f);
+      off[b + j + 1] = off[b + j] + chunk[j].size();
+    }
+  }
+  fseek(f, CHUNK_TABLE, SEEK_SET);
+  fwrite(&off[0], sizeof(int64_t), ncol + 1, f);
+  int err = ferror(f);
+  fclose(f);
+  if (!err) res[1] = off[ncol];
+  return res;
+}
+
+ColumnStream::ColumnStream(XPtr<BigMatrix> xpMat, vector<int> &col_idx, BitSet *skip, int p)
+  : xpMat(xpMat), xAcc(*xpMat), col_idx(col_idx), p(p), mode(IO_PLAIN), fd(-1), start(0),
+    cur_start(0), cur_n(0), cur(0), nrow(xpMat->nrow()) {
+  if (skip == NULL) {
+    for (int j = 0; j < p; j++) cols.push_back(j);
+  } else {
+    // the members are picked word by word, so a scan of a few features
+    // costs p / 64 words, not p tests
+    for (int b = 0; b < skip->nwords(); b++) {
+      uint64_t word = ~skip->w[b];
+      while (word) {
+        int j = (b << 6) + __builtin_ctzll(word);
+        if (j >= p) break;
+        cols.push_back(j);
+        word &= word - 1;
+      }
+    }
+  }
+  blk = cols.size() > 0 ? cols.size() : 1;
+#ifndef _WIN32
+  FileBackedBigMatrix *fb = dynamic_cast<FileBackedBigMatrix*>(xpMat.get());
+  if (fb == NULL || cols.size() == 0) return;
+  if (io_budget > 0 && !xpMat->separated_columns()) {
+    string path = fb->file_path();
+    if (path.size() > 0 && path[path.size() - 1] != '/') path += "/";
+    fd = open((path + fb->file_name()).c_str(), O_RDONLY);
+  }
+  if (fd >= 0 && io_chunks && open_chunks(fb)) {
+    mode = IO_CHUNK;
+    blk = io_budget / 2 / (nrow * sizeof(double));
+    if (blk < 1) blk = 1;
+    buf[0].resize((size_t) blk * nrow);
+    reader = std::thread(&ColumnStream::read_chunks, this, 0, 0);
+  } else if (fd >= 0) {
+    mode = IO_PREAD;
+    blk = io_budget / 2 / (nrow * sizeof(double));
+    if (blk < 1) blk = 1;
+    buf[0].resize((size_t) blk * nrow);
+    buf[1].resize((size_t) blk * nrow);
+    reader = std::thread(&ColumnStream::read_batch, this, 0, 0);
+  } else if (io_hints) {
+    mode = IO_HINT;
+    blk = IO_BLOCK_BYTES / (nrow * sizeof(double));
+    if (blk < 1) blk = 1;
+    advise(0, blk, 1);
+  }
+#endif
+}
+
+ColumnStream::~ColumnStream() {
+  if (reader.joinable()) reader.join();
+#ifndef _WIN32
+  if (fd >= 0) close(fd);
+#endif
+}
+
+// move to the next batch of columns; returns 0 once all have been visited
+int ColumnStream::next() {
+  int m = cols.size();
+  if (start >= m) {
+    if (mode == IO_HINT && cur_n > 0) advise(0, m, 0);
+    cur_n = 0;
+    return 0;
+  }
+  cur_start = start;
+  cur_n = m - start < blk ? m - start : blk;
+  start += cur_n;
+  if (mode == IO_PREAD) {
+    reader.join(); // the batch at cur_start is now in buf[cur]
+    if (cur_start > 0) cur = 1 - cur;
+    if (start < m) reader = std::thread(&ColumnStream::read_batch, this, 1 - cur, start);
+  } else if (mode == IO_CHUNK) {
+    reader.join(); // the compressed batch at cur_start is now in zbuf[cur]
+    if (cur_start > 0) cur = 1 - cur;
+    if (start < m) reader = std::thread(&ColumnStream::read_chunks, this, 1 - cur, start);
+    int k;
+#pragma omp parallel for private(k) schedule(dynamic)
+    for (k = 0; k < cur_n; k++) {
+      double *dst = &buf[0][(size_t) k * nrow];
+      if (!decode_column(&zbuf[cur][zpos[cur][k]], zpos[cur][k + 1] - zpos[cur][k], dst, nrow)) {
+        memcpy(dst, xAcc[col_idx[cols[cur_start + k]]], nrow * sizeof(double));
+      }
+    }
+  } else if (mode == IO_HINT) {
+    advise(start, start + blk, 1);
+  }
+  return 1;
+}
+
+double *ColumnStream::data(int k) {
+  if (mode == IO_PREAD) return &buf[cur][(size_t) k * nrow];
+  if (mode == IO_CHUNK) return &buf[0][(size_t) k * nrow];
+  return xAcc[col_idx[cols[cur_start + k]]];
+}
+
+static int numa_nodes();
+
+// positions [lo, hi) of the current batch for thread t of nt. On a NUMA
+// machine a batch served straight from the mapping is cut at the fixed
+// features p * t / nt, whatever is skipped, so every scan hands a column to
+// the same thread and its pages, faulted in by that thread, stay on the
+// thread's node; otherwise batches are cut evenly.
+void ColumnStream::range(int t, int nt, int *lo, int *hi) const {
+  if (mode == IO_PLAIN && numa_nodes() > 1) {
+    const int *b = cols.data() + cur_start, *e = b + cur_n;
+    *lo = lower_bound(b, e, (int) ((long) p * t / nt)) - b;
+    *hi = lower_bound(b, e, (int) ((long) p * (t + 1) / nt)) - b;
+  } else {
+    *lo = (long) cur_n * t / nt;
+    *hi = (long) cur_n * (t + 1) / nt;
+  }
+}
+
+// read the columns cols[first..first+blk) into buf[b]; a failed read is
+// filled from the memory mapping instead
+void ColumnStream::read_batch(int b, int first) {
+#ifndef _WIN32
+  int last = first + blk < (int) cols.size() ? first + blk : cols.size();
+  size_t len = nrow * sizeof(double), done;
+  ssize_t got;
+  for (int k = first; k < last; k++) {
+    int jj = col_idx[cols[k]];
+    char *dst = (char*) &buf[b][(size_t) (k - first) * nrow];
+    off_t off = ((off_t) (xpMat->col_offset() + jj) * xpMat->total_rows() +
+                 xpMat->row_offset()) * sizeof(double);
+    for (done = 0; done < len; done += got) {
+      got = pread(fd, dst + done, len - done, off + done);
+      if (got <= 0) break;
+    }
+    if (done < len) memcpy(dst, xAcc[jj], len);
+  }
+#endif
+}
+
+// switch fd to the compressed sidecar of fb if there is one of the same
+// shape and stamp as the backing file
+int ColumnStream::open_chunks(FileBackedBigMatrix *fb) {
+#ifndef _WIN32
+  if (nrow != xpMat->total_rows()) return 0;
+  int64_t stamp[CHUNK_STAMP];
+  if (!backing_stamp(fb, stamp)) return 0;
+  string path = fb->file_path();
+  if (path.size() > 0 && path[path.size() - 1] != '/') path += "/";
+  path += fb->file_name();
+  int zfd = open((path + ".bcc").c_str(), O_RDONLY);
+  if (zfd < 0) return 0;
+  char magic[8];
+  int64_t dim[2 + CHUNK_STAMP];
+  long ncol = xpMat->total_columns();
+  zoff.resize(ncol + 1);
+  if (pread(zfd, magic, 8, 0) != 8 || memcmp(magic, CHUNK_MAGIC, 8) != 0 ||
+      pread(zfd, dim, sizeof(dim), 8) != sizeof(dim) || dim[0] != nrow || dim[1] != ncol ||
+      memcmp(&dim[2], stamp, sizeof(stamp)) != 0 ||
+      pread(zfd, &zoff[0], (ncol + 1) * sizeof(int64_t), CHUNK_TABLE) !=
+      (ssize_t) ((ncol + 1) * sizeof(int64_t))) {
+    close(zfd);
+    return 0;
+  }
+  close(fd);
+  fd = zfd;
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+// read the compressed columns cols[first..first+blk) into zbuf[b], column k
+// of the batch at zpos[b][k]; an unreadable column is left empty, so that it
+// fails to decode and is taken from the memory mapping
+void ColumnStream::read_chunks(int b, int first) {
+#ifndef _WIN32
+  int last = first + blk < (int) cols.size() ? first + blk : cols.size();
+  zpos[b].assign(1, 0);
+  for (int k = first; k < last; k++) {
+    int jj = xpMat->col_offset() + col_idx[cols[k]];
+    zpos[b].push_back(zpos[b].back() + zoff[jj + 1] - zoff[jj]);
+  }
+  zbuf[b].resize(zpos[b].back() + 1);
+  size_t done, len;
+  ssize_t got;
+  for (int k = first; k < last; k++) {
+    int jj = xpMat->col_offset() + col_idx[cols[k]];
+    char *dst = &zbuf[b][zpos[b][k - first]];
+    len = zpos[b][k - first + 1] - zpos[b][k - first];
+    for (done = 0; done < len; done += got) {
+      got = pread(fd, dst + done, len - done, zoff[jj] + done);
+      if (got <= 0) break;
+    }
+    if (done < len) memset(dst, 0xff, len);
+  }
+#endif
+}
+
+// madvise the pages of columns cols[first..last); adjacent columns are merged
+// into one range. Read-ahead rounds the range out to whole pages, release
+// rounds it in so that pages shared with a skipped neighbour stay.
+void ColumnStream::advise(int first, int last, int willneed) {
+#ifndef _WIN32
+  if (last > (int) cols.size()) last = cols.size();
+  uintptr_t pg = sysconf(_SC_PAGESIZE);
+  uintptr_t len = nrow * sizeof(double);
+  uintptr_t lo = 0, hi = 0, b;
+  for (int k = first; k <= last; k++) {
+    b = k < last ? (uintptr_t) xAcc[col_idx[cols[k]]] : 0;
+    if (k < last && hi > lo && b == hi) {
+      hi = b + len;
+      continue;
+    }
+    if (hi > lo) {
+      if (willneed) {
+        lo &= ~(pg - 1);
+        madvise((void*) lo, hi - lo, MADV_WILLNEED);
+      } else {
+        lo = (lo + pg - 1) & ~(pg - 1);
+        hi &= ~(pg - 1);
+        if (hi > lo) madvise((void*) lo, hi - lo, MADV_DONTNEED);
+      }
+    }
+    lo = b;
+    hi = b + len;
+  }
+#endif
+}
+
+// z[j] = X_j'r / n for a single feature, with r given by its sum
+static double resid_zj(double *xCol, int *row_idx, vector<int> &col_idx,
+                       NumericVector &center, NumericVector &scale,
+                       double sumResid, double *r, int n, int j) {
+  int jj = col_idx[j];
+  double sum = 0.0;
+  for (int i=0; i < n; i++) {
+    sum = sum + xCol[row_idx[i]] * r[i];
+  }
+  return (sum - center[jj] * sumResid) / (scale[jj] * n);
+}
+
+// whether feature j violates the KKT conditions given z[j]
+static int kkt_violated(vector<double> &z, double *a, vector<int> &col_idx,
+                        double lambda, double alpha, double *m, int j) {
+  double l1 = lambda * m[col_idx[j]] * alpha;
+  double l2 = lambda * m[col_idx[j]] * (1 - alpha);
+  return fabs(z[j] - a[j] * l2) > l1;
+}
+
+// z[j] for the columns of a stream, each thread reading r from its node
+static void scan_zj(ColumnStream &cs, vector<double> &z, int *row_idx, vector<int> &col_idx,
+                    NumericVector &center, NumericVector &scale, double sumResid,
+                    double *r, int n) {
+  NodeCopies rc(r, n);
+  while (cs.next()) {
+    prof_reads(cs.size());
+#pragma omp parallel OMP_SPREAD
+    {
+      double *rl = rc.get();
+      int j, k, lo, hi;
+      cs.range(omp_get_thread_num(), omp_get_num_threads(), &lo, &hi);
+      for (k = lo; k < hi; k++) {
+        j = cs.col(k);
+        z[j] = resid_zj(cs.data(k), row_idx, col_idx, center, scale, sumResid, rl, n, j);
+      }
+    }
+  }
+}
+
+// The scans below compute z in parallel, then add the violations to the index
+// sets in a serial pass so that their member lists stay consistent. Their
+// time, reads and violations go to the KKT phase of the profile.
+
 // check KKT conditions over features in the inactive set
-int check_inactive_set(int *e1, vector<double> &z, XPtr<BigMatrix> xpMat, int *row_idx, 
+int check_inactive_set(IndexSet &e1, vector<double> &z, XPtr<BigMatrix> xpMat, int *row_idx, 
                        vector<int> &col_idx, NumericVector &center, NumericVector &scale, double *a,
                        double lambda, double sumResid, double alpha, double *r, double *m, int n, int p) {
   
-  MatrixAccessor<double> xAcc(*xpMat);
-  double *xCol, sum, l1, l2;
-  int j, jj, violations = 0;
-#pragma omp parallel for private(j, sum, l1, l2) reduction(+:violations) schedule(static) 
+  ProfilePhase ph(PH_KKT);
+  ColumnStream cs(xpMat, col_idx, &e1.mask, p);
+  int j, violations = 0;
+  scan_zj(cs, z, row_idx, col_idx, center, scale, sumResid, r, n);
   for (j = 0; j < p; j++) {
-    if (e1[j] == 0) {
-      jj = col_idx[j];
-      xCol = xAcc[jj];
-      sum = 0.0;
-      for (int i=0; i < n; i++) {
-        sum = sum + xCol[row_idx[i]] * r[i];
-      }
-      z[j] = (sum - center[jj] * sumResid) / (scale[jj] * n);
-      
-      l1 = lambda * m[jj] * alpha;
-      l2 = lambda * m[jj] * (1 - alpha);
-      if (fabs(z[j] - a[j] * l2) > l1) {
-        e1[j] = 1;
-        violations++;
-      }
+    if (e1.has(j) == 0 && kkt_violated(z, a, col_idx, lambda, alpha, m, j)) {
+      e1.add(j);
+      violations++;
     }
   }
+  prof_violations(violations);
   return violations;
 }
 
 // check KKT conditions over features in the safe set
-int check_safe_set(int *ever_active, int *discard_beta, vector<double> &z, 
+int check_safe_set(IndexSet &ever_active, BitSet &discard_beta, vector<double> &z, 
                    XPtr<BigMatrix> xpMat, int *row_idx, vector<int> &col_idx,
                    NumericVector &center, NumericVector &scale, double *a,
                    double lambda, double sumResid, double alpha, 
                    double *r, double *m, int n, int p) {
-  MatrixAccessor<double> xAcc(*xpMat);
-  double *xCol, sum, l1, l2;
-  int j, jj, violations = 0;
-  
-#pragma omp parallel for private(j, sum, l1, l2) reduction(+:violations) schedule(static) 
+  ProfilePhase ph(PH_KKT);
+  int j, violations = 0;
+  BitSet skip = ever_active.mask; // features not scanned: active or safely discarded
+  for (j = 0; j < skip.nwords(); j++) skip.w[j] |= discard_beta.w[j];
+  ColumnStream cs(xpMat, col_idx, &skip, p);
+  scan_zj(cs, z, row_idx, col_idx, center, scale, sumResid, r, n);
   for (j = 0; j < p; j++) {
-    if (ever_active[j] == 0 && discard_beta[j] == 0) {
-      jj = col_idx[j];
-      xCol = xAcc[jj];
-      sum = 0.0;
-      for (int i=0; i < n; i++) {
-        sum = sum + xCol[row_idx[i]] * r[i];
-      }
-      z[j] = (sum - center[jj] * sumResid) / (scale[jj] * n);
-      l1 = lambda * m[jj] * alpha;
-      l2 = lambda * m[jj] * (1 - alpha);
-      if (fabs(z[j] - a[j] * l2) > l1) {
-        ever_active[j] = 1;
-        violations++;
-      }
+    if (skip.test(j) == 0 && kkt_violated(z, a, col_idx, lambda, alpha, m, j)) {
+      ever_active.add(j);
+      violations++;
     }
   }
+  prof_violations(violations);
   return violations;
 }
 
 // check KKT conditions over features in (the safe set - the strong set)
-int check_rest_safe_set(int *ever_active, int *strong_set, int *discard_beta, vector<double> &z,
+int check_rest_safe_set(IndexSet &ever_active, IndexSet &strong_set, BitSet &discard_beta, vector<double> &z,
                         XPtr<BigMatrix> xpMat, int *row_idx, vector<int> &col_idx,
                         NumericVector &center, NumericVector &scale, double *a, double lambda,
                         double sumResid, double alpha, double *r, double *m, int n, int p) {
-  
-  MatrixAccessor<double> xAcc(*xpMat);
-  double *xCol, sum, l1, l2;
-  int j, jj, violations = 0;
-#pragma omp parallel for private(j, sum, l1, l2) reduction(+:violations) schedule(static) 
+  ProfilePhase ph(PH_KKT);
+  int j, violations = 0;
+  BitSet skip = strong_set.mask; // features not scanned: strong or safely discarded
+  for (j = 0; j < skip.nwords(); j++) skip.w[j] |= discard_beta.w[j];
+  ColumnStream cs(xpMat, col_idx, &skip, p);
+  scan_zj(cs, z, row_idx, col_idx, center, scale, sumResid, r, n);
   for (j = 0; j < p; j++) {
-    if (strong_set[j] == 0 && discard_beta[j] == 0) {
-      jj = col_idx[j];
-      xCol = xAcc[jj];
-      sum = 0.0;
-      for (int i=0; i < n; i++) {
-        sum = sum + xCol[row_idx[i]] * r[i];
-      }
-      z[j] = (sum - center[jj] * sumResid) / (scale[jj] * n);
-      
-      l1 = lambda * m[jj] * alpha;
-      l2 = lambda * m[jj] * (1 - alpha);
-      if (fabs(z[j] - a[j] * l2) > l1) {
-        ever_active[j] = strong_set[j] = 1;
-        violations++;
-      }
+    if (strong_set.has(j) == 0 && discard_beta.test(j) == 0 &&
+        kkt_violated(z, a, col_idx, lambda, alpha, m, j)) {
+      ever_active.add(j);
+      strong_set.add(j);
+      violations++;
     }
   }
+  prof_violations(violations);
   return violations;
 }
 
 // check KKT conditions over features in the strong set
-int check_strong_set(int *e1, int *e2, vector<double> &z, XPtr<BigMatrix> xpMat, 
+int check_strong_set(IndexSet &e1, IndexSet &e2, vector<double> &z, XPtr<BigMatrix> xpMat, 
                      int *row_idx, vector<int> &col_idx,
                      NumericVector &center, NumericVector &scale, double *a,
                      double lambda, double sumResid, double alpha, 
                      double *r, double *m, int n, int p) {
-  MatrixAccessor<double> xAcc(*xpMat);
-  double *xCol, sum, l1, l2;
-  int j, jj, violations = 0;
+  ProfilePhase ph(PH_KKT);
+  int j, k, violations = 0;
+  int ns = e2.size();
   
-#pragma omp parallel for private(j, sum, l1, l2) reduction(+:violations) schedule(static) 
-  for (j = 0; j < p; j++) {
-    if (e1[j] == 0 && e2[j] == 1) {
-      jj = col_idx[j];
-      xCol = xAcc[jj];
-      sum = 0.0;
-      for (int i=0; i < n; i++) {
-        sum = sum + xCol[row_idx[i]] * r[i];
-      }
-      z[j] = (sum - center[jj] * sumResid) / (scale[jj] * n);
-      
-      l1 = lambda * m[jj] * alpha;
-      l2 = lambda * m[jj] * (1 - alpha);
-      if(fabs(z[j] - a[j] * l2) > l1) {
-        e1[j] = 1;
-        violations++;
-      }
+  // only the members of the strong set not yet active are read
+  BitSet skip = e1.mask;
+  for (j = 0; j < skip.nwords(); j++) skip.w[j] |= ~e2.mask.w[j];
+  ColumnStream cs(xpMat, col_idx, &skip, p);
+  scan_zj(cs, z, row_idx, col_idx, center, scale, sumResid, r, n);
+  for (k = 0; k < ns; k++) {
+    j = e2.idx[k];
+    if (e1.has(j) == 0 && kkt_violated(z, a, col_idx, lambda, alpha, m, j)) {
+      e1.add(j);
+      violations++;
     }
   }
+  prof_violations(violations);
   return violations;
 }
 
 // check KKT conditions over features in the rest set
-int check_rest_set(int *e1, int *e2, vector<double> &z, XPtr<BigMatrix> xpMat, int *row_idx, 
+int check_rest_set(IndexSet &e1, IndexSet &e2, vector<double> &z, XPtr<BigMatrix> xpMat, int *row_idx, 
                    vector<int> &col_idx, NumericVector &center, NumericVector &scale, double *a,
                    double lambda, double sumResid, double alpha, double *r, double *m, int n, int p) {
-  
-  MatrixAccessor<double> xAcc(*xpMat);
-  double *xCol, sum, l1, l2;
-  int j, jj, violations = 0;
-#pragma omp parallel for private(j, sum, l1, l2) reduction(+:violations) schedule(static) 
+  ProfilePhase ph(PH_KKT);
+  ColumnStream cs(xpMat, col_idx, &e2.mask, p);
+  int j, violations = 0;
+  scan_zj(cs, z, row_idx, col_idx, center, scale, sumResid, r, n);
   for (j = 0; j < p; j++) {
-    if (e2[j] == 0) {
-      jj = col_idx[j];
-      xCol = xAcc[jj];
-      sum = 0.0;
-      for (int i=0; i < n; i++) {
-        sum = sum + xCol[row_idx[i]] * r[i];
-      }
-      z[j] = (sum - center[jj] * sumResid) / (scale[jj] * n);
-      
-      l1 = lambda * m[jj] * alpha;
-      l2 = lambda * m[jj] * (1 - alpha);
-      if (fabs(z[j] - a[j] * l2) > l1) {
-        e1[j] = e2[j] = 1;
-        violations++;
-      }
+    if (e2.has(j) == 0 && kkt_violated(z, a, col_idx, lambda, alpha, m, j)) {
+      e1.add(j);
+      e2.add(j);
+      violations++;
     }
   }
+  prof_violations(violations);
   return violations;
 }
 
 // update z[j] for features which are rejected at previous lambda but not rejected at current one.
 void update_zj(vector<double> &z,
-               int *bedpp_reject, int *bedpp_reject_old,
+               BitSet &bedpp_reject, BitSet &bedpp_reject_old,
                XPtr<BigMatrix> xpMat, int *row_idx,vector<int> &col_idx,
                NumericVector &center, NumericVector &scale, 
                double sumResid, double *r, double *m, int n, int p) {
+  // the features re-admitted at this lambda are the ones read
+  BitSet skip = bedpp_reject;
+  for (int b = 0; b < skip.nwords(); b++) skip.w[b] |= ~bedpp_reject_old.w[b];
+  ColumnStream cs(xpMat, col_idx, &skip, p);
+  scan_zj(cs, z, row_idx, col_idx, center, scale, sumResid, r, n);
+}
+
+// select working set: features with nonzero coefficients, then those with the
+// smallest dual feasibility margin lambda * alpha * m_j - |z_j|
+int ws_select(vector<int> &ws, IndexSet &in_ws, vector<int> &cand, vector<double> &z, double *a,
+              vector<int> &col_idx, double *m, double lambda, double alpha, int ws_size, int p) {
+  int j, ncand = 0;
+  ws.clear();
+  in_ws.clear();
+  for (j = 0; j < p; j++) {
+    if (m[col_idx[j]] == 0 || a[j] != 0) {
+      ws.push_back(j);
+      in_ws.add(j);
+    } else {
+      cand[ncand++] = j;
+    }
+  }
+  int nfill = ws_size - (int) ws.size();
+  if (nfill > ncand) nfill = ncand;
+  if (nfill > 0) {
+    if (nfill < ncand) {
+      nth_element(cand.begin(), cand.begin() + nfill, cand.begin() + ncand,
+                  [&](int u, int v) {
+                    return lambda * alpha * m[col_idx[u]] - fabs(z[u]) <
+                      lambda * alpha * m[col_idx[v]] - fabs(z[v]);
+                  });
+    }
+    for (int k = 0; k < nfill; k++) {
+      ws.push_back(cand[k]);
+      in_ws.add(cand[k]);
+    }
+  }
+  // keep features in column order for sequential access
+  sort(ws.begin(), ws.end());
+  return ws.size();
+}
+
+// crossprod of residual with each feature in the working set, divided by n
+void ws_crossprod(vector<double> &c, vector<int> &ws, XPtr<BigMatrix> xpMat, double *r,
+                  double sumResid, int *row_idx, vector<int> &col_idx,
+                  NumericVector &center, NumericVector &scale, int n) {
   MatrixAccessor<double> xAcc(*xpMat);
   double *xCol, sum;
-  int j, jj;
-  
-#pragma omp parallel for private(j, sum) schedule(static) 
-  for (j = 0; j < p; j++) {
-    if (bedpp_reject[j] == 0 && bedpp_reject_old[j] == 1) {
-      jj = col_idx[j];
-      xCol = xAcc[jj];
-      sum = 0.0;
-      for (int i=0; i < n; i++) {
-        sum = sum + xCol[row_idx[i]] * r[i];
-      }
-      z[j] = (sum - center[jj] * sumResid) / (scale[jj] * n);
+  int t, jj, nws = ws.size();
+  c.resize(nws);
+  prof_reads(nws);
+#pragma omp parallel for private(t, jj, xCol, sum) schedule(static)
+  for (t = 0; t < nws; t++) {
+    jj = col_idx[ws[t]];
+    xCol = xAcc[jj];
+    sum = 0.0;
+    for (int i = 0; i < n; i++) {
+      sum = sum + xCol[row_idx[i]] * r[i];
+    }
+    c[t] = (sum - center[jj] * sumResid) / (scale[jj] * n);
+  }
+}
+
+// penalty of current solution and dual scaling factor over the working set.
+// For lasso the residual is scaled by k <= kmax so that |X_j' theta| <=
+// lambda * m_j; for elastic net the conjugate term is returned in conj.
+static double ws_penalty(double *k, double *conj, double *a, vector<double> &c,
+                         vector<int> &ws, vector<int> &col_idx, double *m,
+                         double lambda, double alpha, double kmax) {
+  double pen = 0.0, ratio = 0.0, l1, l2, v;
+  int t, j, nws = ws.size();
+  for (t = 0; t < nws; t++) {
+    j = ws[t];
+    l1 = lambda * m[col_idx[j]] * alpha;
+    l2 = lambda * m[col_idx[j]] * (1 - alpha);
+    pen += l1 * fabs(a[j]) + 0.5 * l2 * pow(a[j], 2);
+    if (l2 == 0) {
+      if (l1 > 0 && fabs(c[t]) / l1 > ratio) ratio = fabs(c[t]) / l1;
+    }
+  }
+  *k = ratio > 1 ? 1 / ratio : 1;
+  if (*k > kmax) *k = kmax;
+  *conj = 0.0;
+  for (t = 0; t < nws; t++) {
+    j = ws[t];
+    l1 = lambda * m[col_idx[j]] * alpha;
+    l2 = lambda * m[col_idx[j]] * (1 - alpha);
+    if (l2 > 0) {
+      v = fabs(*k * c[t]) - l1;
+      if (v > 0) *conj += pow(v, 2) / (2 * l2);
+    }
+  }
+  return pen;
+}
+
+// Duality gaps. The dual point is the residual scaled to be feasible for the
+// features in ws, so the gap bounds the suboptimality of the problem over
+// those features only: over all the features when ws holds every one of
+// them with c up to date (the gap returned to R), and of the working-set
+// subproblem otherwise (the early stops of the sweeps).
+
+// duality gap of gaussian loss over the features in the working set; the
+// residuals of the centered y sum to 0, as the unpenalized intercept needs
+double gap_gaussian(double *r, double *y, double *a, vector<double> &c, vector<int> &ws,
+                    vector<int> &col_idx, double *m, double lambda, double alpha, int n) {
+  double k, conj, yr = 0.0, rr = gLoss(r, n);
+  double pen = ws_penalty(&k, &conj, a, c, ws, col_idx, m, lambda, alpha, 1.0);
+  for (int i = 0; i < n; i++) yr += y[i] * r[i];
+  double primal = rr / (2 * n) + pen;
+  double dual = k * yr / n - pow(k, 2) * rr / (2 * n) - conj;
+  return primal - dual;
+}
+
+// duality gap of binomial loss over the features in the working set. The
+// unpenalized intercept needs a dual point summing to 0, so s is centered
+// first, which leaves c unchanged as the columns are centered; k is then cut
+// so that every y - k * s stays in [0, 1], down to 0 (the gap is then the
+// primal objective) if a centered s_i has the wrong sign.
+double gap_binomial(double *s, double *y, double dev, double *a, vector<double> &c,
+                    vector<int> &ws, vector<int> &col_idx, double *m, double lambda,
+                    double alpha, int n) {
+  double k, conj, u, t, sbar = 0.0, kmax = 1.0, ent = 0.0;
+  int i;
+  for (i = 0; i < n; i++) sbar += s[i];
+  sbar /= n;
+  for (i = 0; i < n; i++) {
+    // y - k t in [0, 1]: k t in [0, 1] if y = 1, in [-1, 0] if y = 0
+    t = s[i] - sbar;
+    if (y[i] == 1 ? t < 0 : t > 0) kmax = 0.0;
+    else if (fabs(t) * kmax > 1) kmax = 1 / fabs(t);
+  }
+  double pen = ws_penalty(&k, &conj, a, c, ws, col_idx, m, lambda, alpha, kmax);
+  for (i = 0; i < n; i++) {
+    u = y[i] - k * (s[i] - sbar);
+    if (u > 0 && u < 1) ent += u * log(u) + (1 - u) * log(1 - u);
+  }
+  double primal = dev / n + pen;
+  double dual = -ent / n - conj;
+  return primal - dual;
+}
+
+// Anderson extrapolation of K+1 successive iterates stored column-wise in hist:
+// solve (U'U) c = 1 for the K differences U, normalize c to sum to one and
+// combine the last K iterates. Returns 0 if the system is (nearly) singular.
+int anderson_extrapolate(double *out, vector<double> &hist, int n_act, int K) {
+  vector<double> U(n_act * K), A(K * K), c(K, 1.0);
+  int i, k, l, t;
+  for (k = 0; k < K; k++) {
+    for (t = 0; t < n_act; t++) {
+      U[k * n_act + t] = hist[(k + 1) * n_act + t] - hist[k * n_act + t];
+    }
+  }
+  double trace = 0.0;
+  for (k = 0; k < K; k++) {
+    for (l = 0; l <= k; l++) {
+      double val = 0.0;
+      for (t = 0; t < n_act; t++) val += U[k * n_act + t] * U[l * n_act + t];
+      A[k * K + l] = A[l * K + k] = val;
+    }
+    trace += A[k * K + k];
+  }
+  if (trace == 0) return 0;
+  // gaussian elimination with partial pivoting
+  for (k = 0; k < K; k++) {
+    int piv = k;
+    for (i = k + 1; i < K; i++) {
+      if (fabs(A[i * K + k]) > fabs(A[piv * K + k])) piv = i;
+    }
+    if (fabs(A[piv * K + k]) < 1e-14 * trace) return 0;
+    if (piv != k) {
+      for (l = 0; l < K; l++) swap(A[k * K + l], A[piv * K + l]);
+      swap(c[k], c[piv]);
+    }
+    for (i = k + 1; i < K; i++) {
+      double f = A[i * K + k] / A[k * K + k];
+      for (l = k; l < K; l++) A[i * K + l] -= f * A[k * K + l];
+      c[i] -= f * c[k];
+    }
+  }
+  for (k = K - 1; k >= 0; k--) {
+    for (l = k + 1; l < K; l++) c[k] -= A[k * K + l] * c[l];
+    c[k] /= A[k * K + k];
+  }
+  double sum_c = 0.0;
+  for (k = 0; k < K; k++) sum_c += c[k];
+  if (sum_c == 0) return 0;
+  for (t = 0; t < n_act; t++) {
+    out[t] = 0.0;
+    for (k = 0; k < K; k++) out[t] += c[k] / sum_c * hist[(k + 1) * n_act + t];
+  }
+  return 1;
+}
+
+// elastic-net penalty of the coefficients indexed by act
+double enet_penalty(double *a, vector<int> &act, int n_act, vector<int> &col_idx,
+                    double *m, double lambda, double alpha) {
+  double pen = 0.0;
+  for (int t = 0; t < n_act; t++) {
+    int j = act[t];
+    pen += lambda * m[col_idx[j]] * (alpha * fabs(a[j]) + 0.5 * (1 - alpha) * pow(a[j], 2));
+  }
+  return pen;
+}
+
+// binomial deviance for linear predictor eta
+double binomial_dev(double *y, double *eta, int n) {
+  double dev = 0.0;
+  for (int i = 0; i < n; i++) {
+    // log(1 + exp(eta)) - y * eta, computed stably
+    if (eta[i] > 0) {
+      dev += eta[i] + log1p(exp(-eta[i])) - y[i] * eta[i];
+    } else {
+      dev += log1p(exp(eta[i])) - y[i] * eta[i];
+    }
+  }
+  return dev;
+}
+
+// KKT residual of a coordinate at a, the smallest magnitude of a subgradient
+// of the objective in that coordinate, given the negative gradient g of the
+// loss (X_j'r/n, or the weighted one)
+double kkt_resid(double g, double a, double l1, double l2) {
+  if (a == 0) return fabs(g) > l1 ? fabs(g) - l1 : 0.0;
+  return fabs(g - l2 * a - (a > 0 ? l1 : -l1));
+}
+
+// order the coordinates of a sweep: 0 cyclic, 1 random permutation drawn
+// from R's generator (the caller holds GetRNGstate), 2 greedy by the KKT
+// residual at the last visit (Gauss-Southwell)
+void sweep_order(vector<int> &ord, vector<double> &viol, int order) {
+  int n_ord = ord.size();
+  if (order == 1) {
+    for (int k = n_ord - 1; k > 0; k--) {
+      int u = (int) (unif_rand() * (k + 1));
+      if (u > k) u = k;
+      swap(ord[k], ord[u]);
     }
+  } else if (order == 2) {
+    stable_sort(ord.begin(), ord.end(),
+                [&](int u, int v) { return viol[u] > viol[v]; });
   }
 }
 
@@ -517,4 +1377,164 @@ RcppExport SEXP get_eta(SEXP xP, SEXP row_idx_, SEXP beta, SEXP idx_p, SEXP idx_
   UNPROTECT(1);
   return __sexp_result;
   END_RCPP
-}
\ No newline at end of file
+}
+
+// The workspace keeps the blocks returned by finished fits, up to
+// WORKSPACE_KEEP bytes, largest ones released first. A request takes the
+// smallest kept block that fits it and is at most twice its size. New blocks
+// of at least 2 MB are aligned to 2 MB and marked for transparent huge pages,
+// and their first zeroing is split among the OpenMP threads, so that on a
+// NUMA machine their pages are spread over the nodes of the threads that
+// scan them instead of all landing on the node of the master thread; a
+// block taken by a thread of a parallel region (a fold of cvfit_native) is
+// zeroed by that thread. The kept blocks are freed by release_workspace,
+// from release.biglasso() and when the package is unloaded. A failed
+// allocation is an R error on the master thread; on a thread of a parallel
+// region, which must not call R, it throws std::bad_alloc for the region to
+// catch and report once it has ended.
+#define WORKSPACE_KEEP ((size_t) 1 << 30)
+#define HUGE_PAGE ((size_t) 2 << 20)
+
+static std::mutex ws_mutex;
+static std::map<void*, size_t> ws_size;  // every block held, by address
+static std::multimap<size_t, void*> ws_free; // kept blocks, by size
+static size_t ws_kept = 0;
+
+static void zero_block(void *ptr, size_t bytes, int spread) {
+  if (!spread) {
+    memset(ptr, 0, bytes);
+    return;
+  }
+  long nb = (bytes + HUGE_PAGE - 1) / HUGE_PAGE, b;
+#pragma omp parallel for OMP_SPREAD schedule(static)
+  for (b = 0; b < nb; b++) {
+    size_t off = (size_t) b * HUGE_PAGE;
+    memset((char*) ptr + off, 0, off + HUGE_PAGE < bytes ? HUGE_PAGE : bytes - off);
+  }
+}
+
+void *workspace_get(size_t bytes) {
+  if (bytes == 0) return NULL;
+  void *ptr = NULL;
+  {
+    std::lock_guard<std::mutex> lock(ws_mutex);
+    std::multimap<size_t, void*>::iterator it = ws_free.lower_bound(bytes);
+    if (it != ws_free.end() && it->first / 2 <= bytes) {
+      ptr = it->second;
+      ws_kept -= it->first;
+      ws_free.erase(it);
+    }
+  }
+  if (ptr != NULL) {
+    memset(ptr, 0, bytes);
+    return ptr;
+  }
+#ifdef _WIN32
+  ptr = malloc(bytes);
+#else
+  size_t align = bytes >= HUGE_PAGE ? HUGE_PAGE : 64;
+  if (posix_memalign(&ptr, align, bytes) != 0) ptr = NULL;
+#ifdef MADV_HUGEPAGE
+  if (ptr != NULL && bytes >= HUGE_PAGE) madvise(ptr, bytes, MADV_HUGEPAGE);
+#endif
+#endif
+  if (ptr == NULL) {
+    if (omp_in_parallel()) throw std::bad_alloc();
+    Rf_error("could not allocate a workspace buffer of %.0f bytes", (double) bytes);
+  }
+  zero_block(ptr, bytes, bytes >= 2 * HUGE_PAGE && !omp_in_parallel());
+  std::lock_guard<std::mutex> lock(ws_mutex);
+  ws_size[ptr] = bytes;
+  return ptr;
+}
+
+void workspace_put(void *ptr) {
+  if (ptr == NULL) return;
+  std::lock_guard<std::mutex> lock(ws_mutex);
+  size_t bytes = ws_size[ptr];
+  ws_free.insert(std::make_pair(bytes, ptr));
+  ws_kept += bytes;
+  while (ws_kept > WORKSPACE_KEEP) {
+    std::multimap<size_t, void*>::iterator it = --ws_free.end();
+    ws_kept -= it->first;
+    ws_size.erase(it->second);
+    free(it->second);
+    ws_free.erase(it);
+  }
+}
+
+// free the kept blocks, returning their total size in bytes; the buffers
+// held by fits still running stay theirs
+RcppExport SEXP release_workspace() {
+  std::lock_guard<std::mutex> lock(ws_mutex);
+  double bytes = ws_kept;
+  std::multimap<size_t, void*>::iterator it;
+  for (it = ws_free.begin(); it != ws_free.end(); ++it) {
+    ws_size.erase(it->second);
+    free(it->second);
+  }
+  ws_free.clear();
+  ws_kept = 0;
+  return Rcpp::wrap(bytes);
+}
+
+// NUMA nodes of the machine, from the highest id in the sysfs list of online
+// nodes (e.g. "0-1"), so nodes emulated by the kernel (numa=fake) count too
+static int numa_nodes() {
+  static int nodes = 0;
+  if (nodes == 0) {
+    int hi = 0;
+#ifdef __linux__
+    FILE *f = fopen("/sys/devices/system/node/online", "r");
+    if (f != NULL) {
+      char line[256], *c, *end;
+      if (fgets(line, sizeof(line), f) != NULL) {
+        for (c = line; *c; c = end) {
+          long v = strtol(c, &end, 10);
+          if (end == c) end = c + 1;
+          else if (v > hi) hi = v;
+        }
+      }
+      fclose(f);
+    }
+#endif
+    nodes = hi + 1;
+  }
+  return nodes;
+}
+
+// node of the CPU the calling thread runs on
+static int thread_node() {
+#if defined(__linux__) && defined(SYS_getcpu)
+  unsigned cpu, node;
+  if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) return node;
+#endif
+  return 0;
+}
+
+NodeCopies::NodeCopies(double *x, size_t n) : x(x) {
+  int nodes = numa_nodes();
+  if (nodes < 2 || omp_get_max_threads() < 2 || n == 0) return;
+  copy.assign(nodes, (double*) NULL);
+  // the first thread to arrive on each node makes its copy
+#pragma omp parallel OMP_SPREAD
+  {
+    int nd = thread_node(), mine = 0;
+#pragma omp critical(node_copies)
+    if (nd < nodes && copy[nd] == NULL) {
+      copy[nd] = (double*) malloc(n * sizeof(double));
+      mine = 1;
+    }
+    if (mine && copy[nd] != NULL) memcpy(copy[nd], x, n * sizeof(double));
+  }
+}
+
+NodeCopies::~NodeCopies() {
+  for (size_t k = 0; k < copy.size(); k++) free(copy[k]);
+}
+
+double *NodeCopies::get() const {
+  if (copy.empty()) return x;
+  int nd = thread_node();
+  return nd < (int) copy.size() && copy[nd] != NULL ? copy[nd] : x;
+}
@@ -12,6 +12,12 @@
 #include <RcppArmadillo.h>
 #include "bigmemory/BigMatrix.h"
 #include <time.h>
+#include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <new>
+#include <algorithm>
+#include <chrono>
 #include "bigmemory/BigMatrix.h"
 #include "bigmemory/MatrixAccessor.hpp"
 #include "bigmemory/bigmemoryDefines.h"
@@ -25,10 +31,228 @@
 using namespace Rcpp;
 using namespace std;
 
+// Feature mask packed 64 features per word: counts use popcount and scans
+// can jump between set bits, so the O(p) mask passes touch p/64 words.
+// Words are independent, so a parallel loop over words may write its own bits.
+class BitSet {
+public:
+  int p;
+  vector<uint64_t> w;
+  
+  BitSet(int p) : p(p), w((p + 63) / 64, 0) {}
+  
+  int nwords() const { return w.size(); }
+  int test(int j) const { return (w[j >> 6] >> (j & 63)) & 1; }
+  void set(int j) { w[j >> 6] |= (uint64_t) 1 << (j & 63); }
+  void reset(int j) { w[j >> 6] &= ~((uint64_t) 1 << (j & 63)); }
+  void assign(int j, int v) { if (v) set(j); else reset(j); }
+  // set all p bits; the tail of the last word stays zero
+  void set_all() {
+    for (size_t b = 0; b < w.size(); b++) w[b] = ~(uint64_t) 0;
+    if (p & 63) w.back() = ((uint64_t) 1 << (p & 63)) - 1;
+  }
+  int count() const {
+    int c = 0;
+    for (size_t b = 0; b < w.size(); b++) c += __builtin_popcountll(w[b]);
+    return c;
+  }
+};
+
+// Set of feature indices in 0..p-1: a bit mask for O(1) membership tests and
+// the list of members, so that sweeps and counts cost O(size) instead of O(p).
+// The list is kept in increasing order, so that a cyclic sweep visits the
+// features in column order; the sets are filled by scans over j, which append.
+class IndexSet {
+public:
+  BitSet mask;     // bit j is set if j is a member
+  vector<int> idx; // members, in increasing order
+  
+  IndexSet(int p) : mask(p) {}
+  
+  int size() const { return idx.size(); }
+  int has(int j) const { return mask.test(j); }
+  void add(int j) {
+    if (!mask.test(j)) {
+      mask.set(j);
+      if (idx.empty() || idx.back() < j) {
+        idx.push_back(j);
+      } else {
+        idx.insert(std::lower_bound(idx.begin(), idx.end(), j), j);
+      }
+    }
+  }
+  // reset only the bits of current members
+  void clear() {
+    for (size_t k = 0; k < idx.size(); k++) mask.reset(idx[k]);
+    idx.clear();
+  }
+  
+private:
+  IndexSet(const IndexSet &);
+  IndexSet &operator=(const IndexSet &);
+};
+
+// The I/O options of a fit, c(prefetch, budget in MB, compressed) from R,
+// used by the column streams until the end of the entry point.
+//   IoOptions io(io_);
+class IoOptions {
+public:
+  explicit IoOptions(SEXP io_);
+  ~IoOptions();
+  
+private:
+  IoOptions(const IoOptions &);
+  IoOptions &operator=(const IoOptions &);
+};
+
+// Source of the columns for a full scan: the columns col_idx[j] for j in
+// 0..p-1 not in skip, visited in batches. Depending on the I/O options of
+// the fit, a file-backed matrix is read ahead through the memory mapping or
+// streamed with pread into two buffers by a reader thread, from its compressed
+// sidecar if there is one; otherwise there is a single batch served straight
+// from the mapping. data(k) is indexed by raw
+// row number, like a column of MatrixAccessor.
+//   ColumnStream cs(xpMat, col_idx, &skip, p);
+//   while (cs.next()) for (k = 0; k < cs.size(); k++) use(cs.col(k), cs.data(k));
+class ColumnStream {
+public:
+  ColumnStream(XPtr<BigMatrix> xpMat, vector<int> &col_idx, BitSet *skip, int p);
+  ~ColumnStream();
+  
+  int next();
+  int size() const { return cur_n; }
+  int col(int k) const { return cols[cur_start + k]; }
+  double *data(int k);
+  void range(int t, int nt, int *lo, int *hi) const;
+  
+private:
+  enum { IO_PLAIN, IO_HINT, IO_PREAD, IO_CHUNK };
+  XPtr<BigMatrix> xpMat;
+  MatrixAccessor<double> xAcc;
+  vector<int> &col_idx;
+  vector<int> cols; // positions in col_idx to visit
+  int p, mode, fd, blk, start, cur_start, cur_n, cur;
+  long nrow;
+  vector<double> buf[2];
+  vector<int64_t> zoff;     // column offsets in the compressed sidecar
+  vector<char> zbuf[2];     // compressed batches
+  vector<size_t> zpos[2];   // column offsets within zbuf
+  std::thread reader;
+  
+  int open_chunks(FileBackedBigMatrix *fb);
+  void read_chunks(int b, int first);
+  void read_batch(int b, int first);
+  void advise(int first, int last, int willneed);
+  ColumnStream(const ColumnStream &);
+  ColumnStream &operator=(const ColumnStream &);
+};
+
+// Buffers of the solvers, borrowed from a workspace shared by all fits:
+// a buffer goes back to the workspace when it goes out of scope, on every
+// return path, and the next fit reuses its memory instead of allocating and
+// faulting in fresh pages. Buffers come zeroed, like Calloc. The blocks kept
+// between fits are freed by release_workspace. Taken inside a parallel
+// region, a buffer that cannot be allocated throws std::bad_alloc.
+//   WorkBuf<double> r(n); // used as a double *
+void *workspace_get(size_t bytes);
+void workspace_put(void *ptr);
+
+template<typename T>
+class WorkBuf {
+public:
+  explicit WorkBuf(size_t n) : ptr((T*) workspace_get(n * sizeof(T))) {}
+  ~WorkBuf() { workspace_put(ptr); }
+  operator T*() const { return ptr; }
+  void swap(WorkBuf &other) { T *t = ptr; ptr = other.ptr; other.ptr = t; }
+
+private:
+  T *ptr;
+  WorkBuf(const WorkBuf &);
+  WorkBuf &operator=(const WorkBuf &);
+};
+
+template<typename T>
+inline void swap(WorkBuf<T> &a, WorkBuf<T> &b) { a.swap(b); }
+
+// Copies of a vector read by every column of a scan (the residuals r or s),
+// one per NUMA node, each first touched by a thread running on its node: a
+// scan thread reads the copy of its own node instead of pulling the vector
+// across the interconnect for every column. On a single node nothing is
+// copied and get() returns the vector itself.
+//   NodeCopies rc(r, n);
+//   #pragma omp parallel
+//   { double *rl = rc.get(); ... }
+class NodeCopies {
+public:
+  NodeCopies(double *x, size_t n);
+  ~NodeCopies();
+  double *get() const; // the copy of the calling thread's node
+  
+private:
+  double *x;
+  vector<double*> copy; // by node; NULL for nodes without a thread
+  NodeCopies(const NodeCopies &);
+  NodeCopies &operator=(const NodeCopies &);
+};
+
+// Profile of the last fit, by lambda: the seconds spent and the columns of X
+// read in each phase, the coordinate descent sweeps and the KKT violations.
+// The time between two switches of phase goes to the phase being left, so
+// only the switches read the clock. The solvers run on the main thread, which
+// alone updates the profile (never from a parallel region); get_profile
+// returns it to R.
+//   ProfileFit pf(n, L);     // a cdfit_* entry point: preprocessing until
+//   prof_lambda(l);          // each lambda, which starts with screening,
+//   prof_phase(PH_SWEEP);    // then coordinate descent;
+//   ProfilePhase ph(PH_KKT); // a KKT scan or safe-rule update, to its end
+enum { PH_PREP, PH_SCREEN, PH_SWEEP, PH_KKT, PH_SAFE, N_PHASE };
+
+struct Profile {
+  int on, n, L, l, phase;
+  std::chrono::steady_clock::time_point t0;
+  vector<double> time, reads; // L x N_PHASE, column-major
+  vector<int> sweeps, violations;
+};
+extern Profile prof;
+
+int prof_phase(int phase);
+void prof_lambda(int l);
+inline void prof_reads(double cols) {
+  if (prof.on) prof.reads[prof.l + prof.L * prof.phase] += cols;
+}
+inline void prof_sweep() { if (prof.on) prof.sweeps[prof.l]++; }
+inline void prof_violations(int v) { if (prof.on) prof.violations[prof.l] += v; }
+
+class ProfileFit {
+public:
+  ProfileFit(int n, int L);
+  ~ProfileFit();
+  
+private:
+  ProfileFit(const ProfileFit &);
+  ProfileFit &operator=(const ProfileFit &);
+};
+
+class ProfilePhase {
+public:
+  explicit ProfilePhase(int phase) : prev(prof_phase(phase)) {}
+  ~ProfilePhase() { prof_phase(prev); }
+  
+private:
+  int prev;
+  ProfilePhase(const ProfilePhase &);
+  ProfilePhase &operator=(const ProfilePhase &);
+};
+
 double sign(double x);
 
 double sum(double *x, int n);
 
+// sum of x and dot product of x and y, in a fixed order whatever the number
+// of threads
+double det_sum(double *x, long n);
+double det_dot(double *x, double *y, long n);
+
 // template<typename T>
 // T sum(T *x, int n);
 
@@ -58,6 +282,11 @@ double crossprod_bm_Xj_Xk(XPtr<BigMatrix> xMat, int *row_idx,
                           NumericVector &center, NumericVector &scale,
                           int n, int j, int k);
 
+// crossprod of every feature with column xmax_idx, both standardized
+void crossprod_xmax(double *xtx, XPtr<BigMatrix> xpMat, int xmax_idx, int *row_idx,
+                    vector<int> &col_idx, NumericVector &center, NumericVector &scale,
+                    int n, int p);
+
 // double crossprod_bmC(SEXP xP, double *y_, int *row_idx_, double center_,
 //                      double scale_, int n_row, int j);
 
@@ -97,40 +326,76 @@ void standardize_and_get_residual(NumericVector &center, NumericVector &scale,
                                   int *row_idx, double lambda_min, double alpha, int n, int p);
 
 // check KKT conditions over features in the inactive set
-int check_inactive_set(int *e1, vector<double> &z, XPtr<BigMatrix> xpMat, int *row_idx, 
+int check_inactive_set(IndexSet &e1, vector<double> &z, XPtr<BigMatrix> xpMat, int *row_idx, 
                        vector<int> &col_idx, NumericVector &center, NumericVector &scale, double *a,
                        double lambda, double sumResid, double alpha, double *r, double *m, int n, int p);
 
 // check KKT conditions over features in the safe set
-int check_safe_set(int *ever_active, int *discard_beta, vector<double> &z, 
+int check_safe_set(IndexSet &ever_active, BitSet &discard_beta, vector<double> &z, 
                    XPtr<BigMatrix> xpMat, int *row_idx, vector<int> &col_idx,
                    NumericVector &center, NumericVector &scale, double *a,
                    double lambda, double sumResid, double alpha, 
                    double *r, double *m, int n, int p);
 
 // check KKT conditions over features in (the safe set - the strong set)
-int check_rest_safe_set(int *ever_active, int *strong_set, int *discard_beta, vector<double> &z,
+int check_rest_safe_set(IndexSet &ever_active, IndexSet &strong_set, BitSet &discard_beta, vector<double> &z,
                         XPtr<BigMatrix> xpMat, int *row_idx, vector<int> &col_idx,
                         NumericVector &center, NumericVector &scale, double *a, double lambda,
                         double sumResid, double alpha, double *r, double *m, int n, int p);
 
 // check KKT conditions over features in the strong set
-int check_strong_set(int *e1, int *e2, vector<double> &z, XPtr<BigMatrix> xpMat, 
+int check_strong_set(IndexSet &e1, IndexSet &e2, vector<double> &z, XPtr<BigMatrix> xpMat, 
                      int *row_idx, vector<int> &col_idx,
                      NumericVector &center, NumericVector &scale, double *a,
                      double lambda, double sumResid, double alpha, 
                      double *r, double *m, int n, int p);
 
 // check KKT conditions over features in the rest set
-int check_rest_set(int *e1, int *e2, vector<double> &z, XPtr<BigMatrix> xpMat, int *row_idx, 
+int check_rest_set(IndexSet &e1, IndexSet &e2, vector<double> &z, XPtr<BigMatrix> xpMat, int *row_idx, 
                    vector<int> &col_idx, NumericVector &center, NumericVector &scale, double *a,
                    double lambda, double sumResid, double alpha, double *r, double *m, int n, int p);
 
 // update z[j] for features which are rejected at previous lambda but not rejected at current one.
 void update_zj(vector<double> &z,
-               int *bedpp_reject, int *bedpp_reject_old,
+               BitSet &bedpp_reject, BitSet &bedpp_reject_old,
                XPtr<BigMatrix> xpMat, int *row_idx,vector<int> &col_idx,
                NumericVector &center, NumericVector &scale, 
                double sumResid, double *r, double *m, int n, int p);
 
+// select working set: features with nonzero coefficients, then those with the
+// smallest dual feasibility margin lambda * alpha * m_j - |z_j|
+int ws_select(vector<int> &ws, IndexSet &in_ws, vector<int> &cand, vector<double> &z, double *a,
+              vector<int> &col_idx, double *m, double lambda, double alpha, int ws_size, int p);
+
+// crossprod of residual with each feature in the working set, divided by n
+void ws_crossprod(vector<double> &c, vector<int> &ws, XPtr<BigMatrix> xpMat, double *r,
+                  double sumResid, int *row_idx, vector<int> &col_idx,
+                  NumericVector &center, NumericVector &scale, int n);
+
+// duality gaps of gaussian and binomial loss over the features in the
+// working set: of the whole problem if ws holds all the features
+double gap_gaussian(double *r, double *y, double *a, vector<double> &c, vector<int> &ws,
+                    vector<int> &col_idx, double *m, double lambda, double alpha, int n);
+
+double gap_binomial(double *s, double *y, double dev, double *a, vector<double> &c,
+                    vector<int> &ws, vector<int> &col_idx, double *m, double lambda,
+                    double alpha, int n);
+
+// Anderson extrapolation of K+1 successive iterates stored column-wise in hist
+int anderson_extrapolate(double *out, vector<double> &hist, int n_act, int K);
+
+// elastic-net penalty of the coefficients indexed by act
+double enet_penalty(double *a, vector<int> &act, int n_act, vector<int> &col_idx,
+                    double *m, double lambda, double alpha);
+
+// binomial deviance for linear predictor eta
+double binomial_dev(double *y, double *eta, int n);
+
+// KKT residual of a coordinate at a, given the negative gradient g of the loss
+double kkt_resid(double g, double a, double l1, double l2);
+
+// order the coordinates of a sweep: 0 cyclic, 1 random permutation (within
+// GetRNGstate/PutRNGstate), 2 greedy by the KKT residual at the last visit
+void sweep_order(vector<int> &ord, vector<double> &viol, int order);
+
 #endif